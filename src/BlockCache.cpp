@@ -0,0 +1,286 @@
+#include "BlockCache.h"
+
+#include <algorithm>
+
+namespace {
+using remu::InstId;
+
+// control transfers end a block, and so do system instructions, which
+// may redirect execution in ways the block cannot predict
+bool endsBlock(InstId id) {
+    switch (id) {
+        case InstId::Beq:
+        case InstId::Bne:
+        case InstId::Blt:
+        case InstId::Bge:
+        case InstId::Bltu:
+        case InstId::Bgeu:
+        case InstId::Jal:
+        case InstId::Jalr:
+        case InstId::FenceI:
+        case InstId::Ecall:
+        case InstId::Ebreak:
+        case InstId::Mret:
+        case InstId::SfenceVma:
+        case InstId::Csrrw:
+        case InstId::Csrrs:
+        case InstId::Csrrc:
+        case InstId::Csrrwi:
+        case InstId::Csrrsi:
+        case InstId::Csrrci:
+        case InstId::Illegal:
+        case InstId::FetchFault:
+        case InstId::FetchPageFault:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// instructions after which the pc may have to be translated, or no
+// longer be, see Block::remaps
+bool mayRemap(InstId id) {
+    switch (id) {
+        case InstId::Mret:
+        case InstId::SfenceVma:
+        case InstId::Csrrw:
+        case InstId::Csrrs:
+        case InstId::Csrrc:
+        case InstId::Csrrwi:
+        case InstId::Csrrsi:
+        case InstId::Csrrci:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// links start out pointing at an odd pc, which never matches
+constexpr remu::Block::Link NoLink{1, nullptr};
+
+// guest page numbers the instructions of b live on
+std::vector<Word_t> pagesOf(const remu::Block& b) {
+    std::vector<Word_t> pages;
+    for (Word_t pc : b.pcs) {
+        Word_t page = pc >> remu::PageShift;
+        if (std::find(pages.begin(), pages.end(), page) == pages.end()) {
+            pages.push_back(page);
+        }
+    }
+    return pages;
+}
+}  // namespace
+
+namespace remu {
+bool Block::overlaps(Word_t start, Word_t end) const {
+    if (!isTrace) {
+        return start < endPc && startPc < end;
+    }
+    for (Word_t pc : pcs) {
+        if (start < pc + 4 && pc < end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+BlockCache::BlockCache(Memory& mem)
+    : m_mem(mem),
+      m_jumpCache(1u << JumpCacheBits, nullptr),
+      m_traceSize(0),
+      m_traceThreshold(TierConfig().traceThreshold),
+      m_translated(0),
+      m_tracesFormed(0) {
+    m_mem.setCodeWriteHandler([this](Word_t vaddr, int numOfBytes) {
+        invalidate(vaddr, numOfBytes);
+    });
+}
+
+Block* BlockCache::lookupSlow(Word_t pc) {
+    Block* b = nullptr;
+    auto itor = m_blocks.find(pc);
+    if (itor != m_blocks.end()) {
+        b = itor->second.get();
+        m_jumpCache[jumpCacheIndex(pc)] = b;
+    } else {
+        auto block = translate(pc);
+        b = block.get();
+        insert(std::move(block));
+        ++m_translated;
+    }
+    return b;
+}
+
+void BlockCache::insert(std::unique_ptr<Block> block) {
+    Block* b = block.get();
+    for (Word_t page : pagesOf(*b)) {
+        m_pageBlocks[page].push_back(b);
+        m_mem.setPageFlag(page << PageShift, PageCode);
+    }
+    m_jumpCache[jumpCacheIndex(b->startPc)] = b;
+    m_blocks.emplace(b->startPc, std::move(block));
+}
+
+std::unique_ptr<Block> BlockCache::translate(Word_t pc) {
+    auto b = std::make_unique<Block>();
+    b->startPc = pc;
+    b->valid = true;
+    b->isTrace = false;
+    b->links = {NoLink, NoLink};
+    b->execCount = 0;
+    b->native = nullptr;
+
+    // stay within one page so invalidation only has to look at one page
+    Word_t pageEnd = (pc | (PageSize - 1)) + 1;
+    Word_t cur = pc;
+    while (cur != pageEnd && b->insts.size() < MaxBlockSize) {
+        // an undecodable word becomes an Illegal, which faults once it
+        // is reached
+        DecodedInst inst = Instruction(m_mem.vMemRead<Word_t>(cur)).decode();
+        b->insts.push_back(inst);
+        b->pcs.push_back(cur);
+        cur += 4;
+        if (endsBlock(inst.id)) {
+            break;
+        }
+    }
+    b->endPc = cur;
+    b->size = b->insts.size();
+    b->remaps = mayRemap(b->insts.back().id);
+    return b;
+}
+
+Block* BlockCache::record(Block* prev, Block* b) {
+    if (prev != m_tracePath.back() || prev->remaps) {
+        // lost track of the path, e.g. execution stopped in between, or
+        // the path may go on in another address space
+        m_tracePath.clear();
+        return b;
+    }
+    bool closed =
+        std::find(m_tracePath.begin(), m_tracePath.end(), b) !=
+        m_tracePath.end();
+    if (closed || b->isTrace || m_tracePath.size() == MaxTraceBlocks ||
+        m_traceSize + b->size > MaxTraceSize) {
+        bool toHead = b == m_tracePath.front();
+        Block* trace = formTrace();
+        return toHead && trace != nullptr ? trace : b;
+    }
+    m_tracePath.push_back(b);
+    m_traceSize += b->size;
+    return b;
+}
+
+Block* BlockCache::formTrace() {
+    std::vector<Block*> path;
+    path.swap(m_tracePath);
+    if (path.size() < 2) {
+        return nullptr;
+    }
+
+    Block* head = path.front();
+    auto t = std::make_unique<Block>();
+    t->startPc = head->startPc;
+    t->endPc = path.back()->endPc;
+    for (Block* b : path) {
+        t->insts.insert(t->insts.end(), b->insts.begin(), b->insts.end());
+        t->pcs.insert(t->pcs.end(), b->pcs.begin(), b->pcs.end());
+    }
+    t->size = t->insts.size();
+    t->valid = true;
+    t->isTrace = true;
+    t->remaps = path.back()->remaps;
+    t->links = {NoLink, NoLink};
+    t->execCount = head->execCount;
+    t->native = nullptr;
+
+    // the trace takes over the head's entry, the other blocks stay around
+    // for the side exits
+    Block* trace = t.get();
+    retire(head);
+    insert(std::move(t));
+    ++m_tracesFormed;
+    return trace;
+}
+
+void BlockCache::invalidate(Word_t vaddr, int numOfBytes) {
+    Word_t end = vaddr + numOfBytes;
+    std::vector<Block*> victims;
+    for (Word_t page = vaddr >> PageShift; page <= (end - 1) >> PageShift;
+         ++page) {
+        auto itor = m_pageBlocks.find(page);
+        if (itor == m_pageBlocks.end()) {
+            continue;
+        }
+        for (Block* b : itor->second) {
+            if (b->overlaps(vaddr, end) &&
+                std::find(victims.begin(), victims.end(), b) ==
+                    victims.end()) {
+                victims.push_back(b);
+            }
+        }
+    }
+    for (Block* b : victims) {
+        retire(b);
+    }
+}
+
+void BlockCache::rebind(Word_t pc, Handler h) {
+    auto itor = m_pageBlocks.find(pc >> PageShift);
+    if (itor == m_pageBlocks.end()) {
+        return;
+    }
+    for (Block* b : itor->second) {
+        for (size_t i = 0; i < b->pcs.size(); ++i) {
+            if (b->pcs[i] == pc) {
+                b->insts[i].handler = h;
+            }
+        }
+    }
+}
+
+void BlockCache::flush() {
+    for (auto& [page, blocks] : m_pageBlocks) {
+        m_mem.clearPageFlag(page << PageShift, PageCode);
+    }
+    m_pageBlocks.clear();
+    m_tracePath.clear();
+    for (auto& [pc, block] : m_blocks) {
+        block->valid = false;
+        block->size = 0;
+        m_retired.push_back(std::move(block));
+    }
+    m_blocks.clear();
+    std::fill(m_jumpCache.begin(), m_jumpCache.end(), nullptr);
+}
+
+void BlockCache::retire(Block* b) {
+    b->valid = false;
+    b->size = 0;
+    // the recorded path may run through b
+    m_tracePath.clear();
+    for (Word_t page : pagesOf(*b)) {
+        auto itor = m_pageBlocks.find(page);
+        auto& blocks = itor->second;
+        blocks.erase(std::find(blocks.begin(), blocks.end(), b));
+        if (blocks.empty()) {
+            m_mem.clearPageFlag(page << PageShift, PageCode);
+            m_pageBlocks.erase(itor);
+        }
+    }
+    Block*& cached = m_jumpCache[jumpCacheIndex(b->startPc)];
+    if (cached == b) {
+        cached = nullptr;
+    }
+    for (auto& [pc, block] : m_blocks) {
+        for (auto& link : block->links) {
+            if (link.block == b) {
+                link = NoLink;
+            }
+        }
+    }
+    auto itor = m_blocks.find(b->startPc);
+    m_retired.push_back(std::move(itor->second));
+    m_blocks.erase(itor);
+}
+}  // namespace remu
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "ISA.h"
+#include "Instruction.h"
+#include "Jit.h"
+#include "Memory.h"
+#include "Tiering.h"
+
+namespace remu {
+// a guest basic block decoded into a compact op array. a block ends at a
+// branch, jal or jalr (or at a page boundary) and remembers the blocks it
+// exited to, so chained execution does not go back to the block lookup.
+//
+// a trace (superblock) strings together the blocks along a hot path. it
+// has a single entry at startPc and leaves wherever execution stops
+// following the recorded path.
+struct Block {
+    struct Link {
+        Word_t pc;
+        Block* block;
+    };
+
+    Word_t startPc;
+    Word_t endPc;  // pc right after the last instruction
+    std::vector<DecodedInst> insts;
+    std::vector<Word_t> pcs;  // guest pc of each instruction
+    // number of instructions to execute. dropped to 0 when the block is
+    // invalidated while running, so the executor stops after the store
+    // that overwrote it
+    uint32_t size;
+    bool valid;
+    bool isTrace;
+    // ends in an instruction that may change address translation, such
+    // a block is neither chained nor continued into a trace
+    bool remaps;
+    // [0]: fall-through / not taken, [1]: taken or last indirect target
+    std::array<Link, 2> links;
+    // times entered, drives trace recording and native translation
+    uint32_t execCount;
+    NativeCode native;
+
+    Block* chain(Word_t npc) const {
+        if (links[0].pc == npc) {
+            return links[0].block;
+        }
+        if (links[1].pc == npc) {
+            return links[1].block;
+        }
+        return nullptr;
+    }
+
+    bool overlaps(Word_t start, Word_t end) const;
+};
+
+class BlockCache {
+private:
+    static constexpr int JumpCacheBits = 12;
+    static constexpr uint32_t MaxBlockSize = 256;
+    static constexpr uint32_t MaxTraceBlocks = 16;
+    static constexpr uint32_t MaxTraceSize = 512;
+
+    Memory& m_mem;
+    std::unordered_map<Word_t, std::unique_ptr<Block>> m_blocks;
+    // blocks by guest page number, for invalidation
+    std::unordered_map<Word_t, std::vector<Block*>> m_pageBlocks;
+    // direct-mapped pc -> block cache in front of m_blocks
+    std::vector<Block*> m_jumpCache;
+    // invalidated blocks that may still be running
+    std::vector<std::unique_ptr<Block>> m_retired;
+    // blocks entered since a block became hot, m_tracePath[0] is the head
+    std::vector<Block*> m_tracePath;
+    uint32_t m_traceSize;
+    // block entries before recording a trace from a block
+    uint32_t m_traceThreshold;
+
+    uint64_t m_translated;
+    uint64_t m_tracesFormed;
+
+public:
+    explicit BlockCache(Memory& mem);
+    ~BlockCache() = default;
+
+    // find the block starting at pc, translating it on a miss
+    Block* lookup(Word_t pc) {
+        Block* b = m_jumpCache[jumpCacheIndex(pc)];
+        if (b != nullptr && b->startPc == pc) [[likely]] {
+            return b;
+        }
+        return lookupSlow(pc);
+    }
+
+    void link(Block* from, Word_t npc, Block* to) {
+        if (from->remaps) {
+            return;
+        }
+        from->links[npc == from->endPc ? 0 : 1] = {npc, to};
+    }
+
+    // called before running b, prev is the block that ran right before it
+    // or nullptr. counts executions and records the path taken from hot
+    // blocks. returns the block to run, which is a new trace once a
+    // recorded path closes
+    Block* enter(Block* prev, Block* b) {
+        ++b->execCount;
+        if (!m_tracePath.empty()) [[unlikely]] {
+            return record(prev, b);
+        }
+        if (b->execCount == m_traceThreshold && !b->isTrace) [[unlikely]] {
+            m_tracePath.push_back(b);
+            m_traceSize = b->size;
+        }
+        return b;
+    }
+
+    void setTraceThreshold(uint32_t n) { m_traceThreshold = n; }
+    uint64_t translatedCount() const { return m_translated; }
+    uint64_t tracesFormedCount() const { return m_tracesFormed; }
+
+    // drop every block overlapping [vaddr, vaddr + numOfBytes)
+    void invalidate(Word_t vaddr, int numOfBytes);
+    // have every block holding the instruction at pc run h for it. native
+    // code keeps its own, which leaves to the handler where it matters
+    void rebind(Word_t pc, Handler h);
+    void flush();
+
+    // free invalidated blocks, only call when no block is running
+    void releaseRetired() {
+        if (!m_retired.empty()) [[unlikely]] {
+            m_retired.clear();
+        }
+    }
+
+private:
+    static uint32_t jumpCacheIndex(Word_t pc) {
+        return (pc >> 2) & ((1u << JumpCacheBits) - 1);
+    }
+
+    Block* lookupSlow(Word_t pc);
+    std::unique_ptr<Block> translate(Word_t pc);
+    Block* record(Block* prev, Block* b);
+    Block* formTrace();
+    void insert(std::unique_ptr<Block> block);
+    void retire(Block* b);
+};
+}  // namespace remu
@@ -0,0 +1,306 @@
+#include "BranchModel.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace remu {
+namespace {
+// TAGE entry fields, the tag of BranchModel::TagBits lowest
+constexpr uint16_t TagMask = (1u << 11) - 1;
+constexpr int UsefulShift = 11;
+constexpr uint16_t UsefulMask = 3u << UsefulShift;
+constexpr int CounterShift = 13;
+
+uint32_t tageCounter(uint16_t e) { return e >> CounterShift; }
+uint32_t tageUseful(uint16_t e) { return (e & UsefulMask) >> UsefulShift; }
+uint16_t tageEntry(uint32_t tag, uint32_t useful, uint32_t counter) {
+    return (tag & TagMask) | (useful << UsefulShift) |
+           (counter << CounterShift);
+}
+
+uint8_t saturate(uint8_t counter, bool up, uint8_t max) {
+    return up ? (counter < max ? counter + 1 : max)
+              : (counter > 0 ? counter - 1 : 0);
+}
+}  // namespace
+
+bool BranchConfig::valid() const {
+    return tableBits >= 4 && tableBits <= 20 && btbBits >= 2 &&
+           btbBits <= 20 && rasDepth >= 1 && rasDepth <= 1024;
+}
+
+bool parseBranchConfig(const char *arg, BranchConfig &c) {
+    const char *end = std::strchr(arg, ',');
+    size_t len = end != nullptr ? end - arg : std::strlen(arg);
+    if (len == 7 && std::strncmp(arg, "bimodal", len) == 0) {
+        c.direction = DirectionPredictor::Bimodal;
+    } else if (len == 6 && std::strncmp(arg, "gshare", len) == 0) {
+        c.direction = DirectionPredictor::Gshare;
+    } else if (len == 4 && std::strncmp(arg, "tage", len) == 0) {
+        c.direction = DirectionPredictor::Tage;
+    } else if (len != 0) {
+        return false;
+    }
+    uint32_t *fields[] = {&c.tableBits, &c.btbBits, &c.rasDepth};
+    for (uint32_t *field : fields) {
+        if (end == nullptr) {
+            return c.valid();
+        }
+        const char *p = end + 1;
+        char *next;
+        unsigned long v = std::strtoul(p, &next, 0);
+        if (next != p) {
+            *field = v;
+        }
+        if (*next != '\0' && *next != ',') {
+            return false;
+        }
+        end = *next == ',' ? next : nullptr;
+    }
+    return end == nullptr && c.valid();
+}
+
+BranchModel::BranchModel(const BranchConfig &config)
+    : m_config(config),
+      m_tableMask((1u << config.tableBits) - 1),
+      m_history(0),
+      // weakly not taken
+      m_counters(size_t{1} << config.tableBits, 1),
+      m_tageClock(0),
+      m_btb(size_t{1} << config.btbBits, BtbEntry{0, 0}),
+      m_ras(config.rasDepth, 0),
+      m_rasTop(0),
+      m_sites(1024),
+      m_siteCount(0) {
+    if (config.direction == DirectionPredictor::Tage) {
+        m_tage.assign(size_t{TageTables} << config.tableBits, 0);
+        for (int t = 0; t < TageTables; ++t) {
+            m_folded[t] = {config.tableBits + TagBits, TageHistory[t]};
+        }
+    }
+}
+
+void BranchModel::pushHistory(bool taken) {
+    m_history = (m_history << 1) | taken;
+    if (m_config.direction == DirectionPredictor::Tage) {
+        for (int t = 0; t < TageTables; ++t) {
+            m_folded[t].push(m_history);
+        }
+    }
+}
+
+bool BranchModel::predictDirection(Word_t pc, bool taken) {
+    uint32_t base = (pc >> 2) & m_tableMask;
+    switch (m_config.direction) {
+        case DirectionPredictor::Bimodal:
+        case DirectionPredictor::Gshare: {
+            uint32_t i = m_config.direction == DirectionPredictor::Gshare
+                             ? (base ^ static_cast<uint32_t>(m_history)) &
+                                   m_tableMask
+                             : base;
+            bool predicted = m_counters[i] >= 2;
+            m_counters[i] = saturate(m_counters[i], taken, 3);
+            return predicted;
+        }
+        case DirectionPredictor::Tage:
+        default:
+            break;
+    }
+
+    // the longest history that hits provides, the next one is the
+    // alternative
+    uint32_t index[TageTables];
+    uint16_t tag[TageTables];
+    int provider = -1;
+    int alt = -1;
+    for (int t = TageTables - 1; t >= 0; --t) {
+        index[t] = tageIndex(t, pc);
+        tag[t] = tageTag(t, pc);
+        if ((m_tage[index[t]] & TagMask) != tag[t]) {
+            continue;
+        }
+        if (provider < 0) {
+            provider = t;
+        } else if (alt < 0) {
+            alt = t;
+        }
+    }
+    bool basePredicted = m_counters[base] >= 2;
+    bool altPredicted = alt >= 0
+                            ? tageCounter(m_tage[index[alt]]) >= 4
+                            : basePredicted;
+    bool predicted = basePredicted;
+    if (provider >= 0) {
+        uint16_t &e = m_tage[index[provider]];
+        predicted = tageCounter(e) >= 4;
+        uint32_t useful = tageUseful(e);
+        if (predicted != altPredicted) {
+            useful = saturate(useful, predicted == taken, 3);
+        }
+        e = tageEntry(e, useful, saturate(tageCounter(e), taken, 7));
+    } else {
+        m_counters[base] = saturate(m_counters[base], taken, 3);
+    }
+
+    // a miss takes an entry with a longer history, one not useful lately
+    if (predicted != taken && provider < TageTables - 1) {
+        bool allocated = false;
+        for (int t = provider + 1; t < TageTables && !allocated; ++t) {
+            if (tageUseful(m_tage[index[t]]) == 0) {
+                m_tage[index[t]] = tageEntry(tag[t], 0, taken ? 4 : 3);
+                allocated = true;
+            }
+        }
+        for (int t = provider + 1; t < TageTables && !allocated; ++t) {
+            uint16_t &e = m_tage[index[t]];
+            e = tageEntry(e, tageUseful(e) - 1, tageCounter(e));
+        }
+    }
+    // age the useful counters, so that stale entries can be replaced
+    if (++m_tageClock % UsefulResetPeriod == 0) {
+        for (uint16_t &e : m_tage) {
+            e = tageEntry(e, tageUseful(e) >> 1, tageCounter(e));
+        }
+    }
+    return predicted;
+}
+
+BranchSite &BranchModel::siteOf(Word_t pc) {
+    size_t mask = m_sites.size() - 1;
+    uint32_t h = (pc >> 2) * 0x9e3779b1u;
+    for (size_t i = (h ^ (h >> 16)) & mask;; i = (i + 1) & mask) {
+        BranchSite &s = m_sites[i];
+        if (s.pc == pc && s.executed != 0) {
+            return s;
+        }
+        if (s.executed != 0) {
+            continue;
+        }
+        // an empty slot, kept at most half full
+        if (2 * (m_siteCount + 1) > m_sites.size()) {
+            std::vector<BranchSite> old(m_sites.size() * 2);
+            old.swap(m_sites);
+            m_siteCount = 0;
+            for (const BranchSite &o : old) {
+                if (o.executed != 0) {
+                    siteOf(o.pc) = o;
+                }
+            }
+            return siteOf(pc);
+        }
+        ++m_siteCount;
+        s.pc = pc;
+        return s;
+    }
+}
+
+bool BranchModel::branch(Word_t pc, bool taken, Word_t target) {
+    BranchSite &s = siteOf(pc);
+    ++s.executed;
+    s.taken += taken;
+    ++m_stats.branches;
+
+    bool predictedTaken = predictDirection(pc, taken);
+    // a taken prediction redirects fetch only if the BTB has a target
+    Word_t predicted = pc + 4;
+    if (predictedTaken && btbLookup(pc) != 0) {
+        predicted = btbLookup(pc);
+    }
+    Word_t actual = taken ? target : pc + 4;
+    if (predictedTaken != taken) {
+        ++m_stats.directionMisses;
+    } else if (taken && predicted != target) {
+        ++m_stats.btbMisses;
+    }
+    if (predicted != actual) {
+        ++m_stats.mispredicted;
+        ++s.mispredicted;
+    }
+    if (taken) {
+        btbUpdate(pc, target);
+    }
+    pushHistory(taken);
+    return predicted != actual;
+}
+
+bool BranchModel::jump(Word_t pc, Word_t target, uint32_t rd, uint32_t rs1,
+                       bool indirect) {
+    bool call = rd == 1 || rd == 5;
+    bool ret = indirect && (rs1 == 1 || rs1 == 5) && rs1 != rd;
+    BranchSite &s = siteOf(pc);
+    ++s.executed;
+    ++s.taken;
+
+    Word_t predicted;
+    if (ret) {
+        ++m_stats.returns;
+        predicted = 0;
+        if (m_rasTop != 0) {
+            --m_rasTop;
+            predicted = m_ras[m_rasTop % m_ras.size()];
+        }
+        m_stats.rasMisses += predicted != target;
+    } else {
+        ++m_stats.jumps;
+        predicted = btbLookup(pc);
+        m_stats.btbMisses += predicted != target;
+        btbUpdate(pc, target);
+    }
+    if (predicted != target) {
+        ++m_stats.mispredicted;
+        ++s.mispredicted;
+    }
+    if (call) {
+        // the oldest entry goes once the stack is full
+        m_ras[m_rasTop % m_ras.size()] = pc + 4;
+        ++m_rasTop;
+    }
+    return predicted != target;
+}
+
+std::vector<BranchSite> BranchModel::sites() const {
+    std::vector<BranchSite> sites;
+    sites.reserve(m_siteCount);
+    for (const BranchSite &s : m_sites) {
+        if (s.executed != 0) {
+            sites.push_back(s);
+        }
+    }
+    std::sort(sites.begin(), sites.end(),
+              [](const BranchSite &a, const BranchSite &b) {
+                  return a.mispredicted != b.mispredicted
+                             ? a.mispredicted > b.mispredicted
+                             : a.pc < b.pc;
+              });
+    return sites;
+}
+
+void BranchModel::print(uint64_t instructions, size_t top) const {
+    static const char *const directions[] = {"bimodal", "gshare", "tage"};
+    const BranchStats &s = m_stats;
+    uint64_t all = s.branches + s.jumps + s.returns;
+    std::printf("%s, 2^%u entries, 2^%u btb entries, %u deep ras\n",
+                directions[static_cast<int>(m_config.direction)],
+                m_config.tableBits, m_config.btbBits, m_config.rasDepth);
+    std::printf("%" PRIu64 " branches, %" PRIu64 " jumps, %" PRIu64
+                " returns\n",
+                s.branches, s.jumps, s.returns);
+    std::printf("%" PRIu64 " mispredicted (%.3f%%, %.3f mpki): %" PRIu64
+                " direction, %" PRIu64 " btb, %" PRIu64 " ras\n",
+                s.mispredicted, all != 0 ? 100.0 * s.mispredicted / all : 0.0,
+                instructions != 0 ? 1000.0 * s.mispredicted / instructions
+                                  : 0.0,
+                s.directionMisses, s.btbMisses, s.rasMisses);
+    std::vector<BranchSite> sites = this->sites();
+    for (size_t i = 0; i < sites.size() && i < top; ++i) {
+        const BranchSite &b = sites[i];
+        std::printf("  0x%08x %12" PRIu64 " execs %6.2f%% taken %10" PRIu64
+                    " mispredicted (%.2f%%)\n",
+                    b.pc, b.executed, 100.0 * b.taken / b.executed,
+                    b.mispredicted, 100.0 * b.mispredicted / b.executed);
+    }
+}
+}  // namespace remu
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ISA.h"
+
+namespace remu {
+enum class DirectionPredictor : uint8_t { Bimodal, Gshare, Tage };
+
+struct BranchConfig {
+    DirectionPredictor direction = DirectionPredictor::Gshare;
+    // log2 of the entries of the counter table, and of each tagged TAGE
+    // table, up to 20. gshare hashes as many bits of history into its index
+    uint32_t tableBits = 12;
+    uint32_t btbBits = 10;  // log2 of the BTB entries, direct mapped
+    uint32_t rasDepth = 16;
+
+    // table sizes in range, a RAS of at least one entry
+    bool valid() const;
+};
+
+// "bimodal|gshare|tage[,table bits][,btb bits][,ras depth]", empty fields
+// keep their value
+bool parseBranchConfig(const char *arg, BranchConfig &c);
+
+// one static control transfer
+struct BranchSite {
+    Word_t pc = 0;
+    uint64_t executed = 0;
+    uint64_t taken = 0;
+    uint64_t mispredicted = 0;
+};
+
+struct BranchStats {
+    uint64_t branches = 0;  // conditional ones
+    uint64_t jumps = 0;     // jal and jalr that are not returns
+    uint64_t returns = 0;
+    uint64_t mispredicted = 0;  // fetch went on at the wrong pc
+    uint64_t directionMisses = 0;
+    uint64_t btbMisses = 0;  // taken, but no or a stale BTB entry
+    uint64_t rasMisses = 0;
+};
+
+// predicts the pc fetch goes on at after each control transfer, as a
+// front end would: a direction predictor for conditional branches, a BTB
+// for the targets of taken ones and of jumps, and a return address stack.
+// all tables are flat arrays of small counters and tags. per-site counts
+// sit in an open addressed table keyed by pc
+class BranchModel {
+private:
+    // TAGE-lite: a bimodal base and tagged tables indexed with
+    // geometrically longer histories. an entry packs a 3-bit counter, a
+    // 2-bit useful counter and an 11-bit tag
+    static constexpr int TageTables = 4;
+    static constexpr uint32_t TageHistory[TageTables] = {5, 12, 27, 60};
+    static constexpr uint32_t UsefulResetPeriod = 1u << 18;
+    static constexpr uint32_t TagBits = 11;
+
+    struct BtbEntry {
+        Word_t pc;
+        Word_t target;
+    };
+
+    BranchConfig m_config;
+    uint32_t m_tableMask;
+    uint64_t m_history;  // global, newest outcome in bit 0
+    std::vector<uint8_t> m_counters;  // 2-bit, bimodal, gshare, TAGE base
+    std::vector<uint16_t> m_tage;  // the tagged tables, one after another
+    // each table's history folded down to the bits of an index and a tag
+    // above it, kept up to date a bit at a time
+    struct FoldedHistory {
+        uint32_t value;
+        uint32_t width;
+        uint32_t mask;
+        uint32_t length;
+        uint32_t outShift;  // where the bit leaving the history folds to
+
+        FoldedHistory() = default;
+        FoldedHistory(uint32_t width, uint32_t length)
+            : value(0), width(width), mask((1u << width) - 1),
+              length(length), outShift(length % width) {}
+        void push(uint64_t history) {
+            value = (value << 1) | (history & 1);
+            value ^= ((history >> length) & 1) << outShift;
+            value = (value ^ (value >> width)) & mask;
+        }
+    };
+    FoldedHistory m_folded[TageTables];
+    uint32_t m_tageClock;
+    std::vector<BtbEntry> m_btb;
+    std::vector<Word_t> m_ras;
+    uint32_t m_rasTop;  // entries pushed, wraps over the oldest
+
+    BranchStats m_stats;
+    std::vector<BranchSite> m_sites;
+    size_t m_siteCount;
+
+    bool predictDirection(Word_t pc, bool taken);
+    void pushHistory(bool taken);
+    uint32_t tageIndex(int table, Word_t pc) const {
+        return (table << m_config.tableBits) |
+               (((pc >> 2) ^ (pc >> (2 + m_config.tableBits)) ^
+                 m_folded[table].value) &
+                m_tableMask);
+    }
+    uint16_t tageTag(int table, Word_t pc) const {
+        return ((pc >> 2) ^ (m_folded[table].value >> m_config.tableBits)) &
+               ((1u << TagBits) - 1);
+    }
+
+    // the BTB's target for pc, 0 on a miss
+    Word_t btbLookup(Word_t pc) const {
+        const BtbEntry &e = m_btb[(pc >> 2) & (m_btb.size() - 1)];
+        return e.pc == pc ? e.target : 0;
+    }
+    void btbUpdate(Word_t pc, Word_t target) {
+        m_btb[(pc >> 2) & (m_btb.size() - 1)] = BtbEntry{pc, target};
+    }
+    BranchSite &siteOf(Word_t pc);
+
+public:
+    // config must be valid
+    explicit BranchModel(const BranchConfig &config);
+    ~BranchModel() = default;
+
+    const BranchConfig &config() const { return m_config; }
+
+    // a conditional branch at pc, its target taken or not. these return
+    // true if it was mispredicted
+    bool branch(Word_t pc, bool taken, Word_t target);
+    // a jal or jalr at pc, with rd and rs1 as decoded. writing x1 or x5,
+    // which hold return addresses, makes it a call, and a jalr through
+    // one of them that does not write it a return
+    bool jump(Word_t pc, Word_t target, uint32_t rd, uint32_t rs1,
+              bool indirect);
+
+    const BranchStats &stats() const { return m_stats; }
+    // the sites seen, most mispredicted first
+    std::vector<BranchSite> sites() const;
+
+    // totals, and the top sites
+    void print(uint64_t instructions, size_t top = 16) const;
+};
+}  // namespace remu
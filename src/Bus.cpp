@@ -0,0 +1,161 @@
+#include "Bus.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace remu {
+void Bus::indexPages(const Region &r, uint8_t value) {
+    auto first = m_pageRegion.begin() + (r.base >> PageShift);
+    std::fill(first, first + (r.size >> PageShift), value);
+}
+
+bool Bus::add(Region r) {
+    if (r.size == 0 || ((r.base | r.size) & (PageSize - 1)) != 0 ||
+        uint64_t{r.base} + r.size > (1ull << 32) ||
+        m_regions.size() == MaxRegions) {
+        return false;
+    }
+    for (const Region &other : m_regions) {
+        if (r.base < other.base + (other.size - 1) + 1ull &&
+            other.base < r.base + (r.size - 1) + 1ull) {
+            return false;
+        }
+    }
+    auto pos = std::upper_bound(
+        m_regions.begin(), m_regions.end(), r.base,
+        [](Word_t base, const Region &region) { return base < region.base; });
+    size_t index = pos - m_regions.begin();
+    // the regions above move up by one
+    for (size_t i = index; i < m_regions.size(); ++i) {
+        indexPages(m_regions[i], i + 2);
+    }
+    indexPages(r, index + 1);
+    m_regions.insert(pos, std::move(r));
+    return true;
+}
+
+bool Bus::addRam(Word_t base, Word_t size, uint8_t *host) {
+    return add(Region{.name = "ram",
+                      .base = base,
+                      .size = size,
+                      .kind = RegionKind::Ram,
+                      .host = host});
+}
+
+bool Bus::addRom(const std::string &name, Word_t base,
+                 std::vector<uint8_t> image) {
+    image.resize((image.size() + PageSize - 1) & ~size_t(PageSize - 1));
+    if (image.size() > UINT32_MAX) {
+        return false;
+    }
+    Region r{.name = name,
+             .base = base,
+             .size = static_cast<Word_t>(image.size()),
+             .kind = RegionKind::Rom};
+    r.rom = std::make_shared<std::vector<uint8_t>>(std::move(image));
+    r.host = r.rom->data();
+    return add(std::move(r));
+}
+
+bool Bus::addMmio(const std::string &name, Word_t base, Word_t size,
+                  MmioReadFunc read, MmioWriteFunc write,
+                  MmioCloneFunc clone) {
+    return add(Region{.name = name,
+                      .base = base,
+                      .size = size,
+                      .kind = RegionKind::Mmio,
+                      .host = nullptr,
+                      .read = std::move(read),
+                      .write = std::move(write),
+                      .clone = std::move(clone)});
+}
+
+std::vector<Region> Bus::copyDevices() const {
+    std::vector<Region> devices;
+    for (const Region &r : m_regions) {
+        if (r.kind == RegionKind::Ram) {
+            continue;
+        }
+        Region &copy = devices.emplace_back(r);
+        if (copy.clone) {
+            copy.clone(copy);
+        }
+    }
+    return devices;
+}
+
+bool Bus::addDevices(const std::vector<Region> &devices) {
+    for (const Region &r : devices) {
+        Region copy = r;
+        if (copy.clone) {
+            copy.clone(copy);
+        }
+        if (!add(std::move(copy))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Bus::read(Word_t addr, int numOfBytes, Word_t &data) {
+    const Region *r = find(addr);
+    if (r == nullptr || !r->contains(addr, numOfBytes)) {
+        return false;
+    }
+    switch (r->kind) {
+        case RegionKind::Rom:
+            data = 0;
+            std::memcpy(&data, r->host + (addr - r->base), numOfBytes);
+            return true;
+        case RegionKind::Mmio:
+            return r->read && r->read(addr - r->base, numOfBytes, data);
+        case RegionKind::Ram:
+        default:
+            return false;
+    }
+}
+
+bool Bus::write(Word_t addr, int numOfBytes, Word_t data) {
+    const Region *r = find(addr);
+    if (r == nullptr || !r->contains(addr, numOfBytes) ||
+        r->kind != RegionKind::Mmio) {
+        return false;
+    }
+    return r->write && r->write(addr - r->base, numOfBytes, data);
+}
+
+bool Bus::fetch(Word_t addr, Word_t &bits) const {
+    const Region *r = find(addr);
+    if (r == nullptr || r->kind != RegionKind::Rom ||
+        !r->contains(addr, 4)) {
+        return false;
+    }
+    std::memcpy(&bits, r->host + (addr - r->base), 4);
+    return true;
+}
+
+void Bus::restoreDevices(const std::vector<Region> &devices) {
+    for (const Region &r : devices) {
+        auto itor = std::find_if(
+            m_regions.begin(), m_regions.end(), [&r](const Region &region) {
+                return region.base == r.base && region.kind == r.kind;
+            });
+        if (itor == m_regions.end()) {
+            continue;
+        }
+        *itor = r;
+        if (itor->clone) {
+            itor->clone(*itor);
+        }
+    }
+}
+
+void Bus::print() const {
+    static const char *const kinds[] = {"ram", "rom", "mmio"};
+    for (const Region &r : m_regions) {
+        std::printf("0x%08x-0x%08x %-4s %s\n", r.base, r.base + (r.size - 1),
+                    kinds[static_cast<int>(r.kind)], r.name.data());
+    }
+}
+}  // namespace remu
@@ -1,10 +1,109 @@
 #pragma once
 
-#include "Processor.h"
-#include "Memory.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ISA.h"
 
 namespace remu {
-struct Bus {
-    Processor& cpu; 
+// guest pages, the granularity of the address map and of everything
+// Memory keeps per page
+constexpr int PageShift = 12;
+constexpr Word_t PageSize = 1u << PageShift;
+
+// device callbacks. offset is relative to the start of the region, and
+// returning false raises an access fault
+using MmioReadFunc =
+    std::function<bool(Word_t offset, int numOfBytes, Word_t &data)>;
+using MmioWriteFunc =
+    std::function<bool(Word_t offset, int numOfBytes, Word_t data)>;
+
+struct Region;
+// gives the copy of a device in a cloned machine callbacks over a copy of
+// its state, see Bus::copyDevices
+using MmioCloneFunc = std::function<void(Region &copy)>;
+
+enum class RegionKind : uint8_t { Ram, Rom, Mmio };
+
+struct Region {
+    std::string name;
+    Word_t base;
+    Word_t size;
+    RegionKind kind;
+    uint8_t *host;  // contents of Ram and Rom
+    // Rom contents, never written, so copies of the region share them
+    std::shared_ptr<std::vector<uint8_t>> rom;
+    MmioReadFunc read;
+    MmioWriteFunc write;
+    MmioCloneFunc clone;
+
+    // [addr, addr + numOfBytes) lies in the region
+    bool contains(Word_t addr, Word_t numOfBytes) const {
+        return addr - base < size && size - (addr - base) >= numOfBytes;
+    }
+};
+
+// the guest physical address map. regions are kept sorted by base, and a
+// per-page index finds the region of an address with a single load.
+// Memory reaches RAM without asking the bus, so only accesses outside RAM
+// come here
+class Bus {
+private:
+    static constexpr uint8_t NoRegion = 0;
+    static constexpr size_t MaxRegions = UINT8_MAX;
+
+    std::vector<Region> m_regions;
+    // 1 + index into m_regions for every guest page, NoRegion if unmapped
+    std::vector<uint8_t> m_pageRegion;
+
+public:
+    Bus() : m_pageRegion(size_t{1} << (32 - PageShift), NoRegion) {}
+    ~Bus() = default;
+    Bus(const Bus &) = delete;
+    Bus &operator=(const Bus &) = delete;
+
+    // regions are page aligned and may not overlap, false otherwise. a
+    // ROM image is padded with zeros to whole pages
+    bool addRam(Word_t base, Word_t size, uint8_t *host);
+    bool addRom(const std::string &name, Word_t base,
+                std::vector<uint8_t> image);
+    bool addMmio(const std::string &name, Word_t base, Word_t size,
+                 MmioReadFunc read, MmioWriteFunc write,
+                 MmioCloneFunc clone = {});
+
+    // copies of the ROM and MMIO regions, taken for a snapshot of the
+    // machine. a device without a clone hook shares its callbacks, and
+    // whatever state they reach, with the copy
+    std::vector<Region> copyDevices() const;
+    // regions from copyDevices() of another bus, copied once more
+    bool addDevices(const std::vector<Region> &devices);
+    // put devices back as copyDevices() of this bus took them
+    void restoreDevices(const std::vector<Region> &devices);
+
+    const Region *find(Word_t addr) const {
+        uint8_t i = m_pageRegion[addr >> PageShift];
+        return i == NoRegion ? nullptr : &m_regions[i - 1];
+    }
+    const std::vector<Region> &regions() const { return m_regions; }
+    // index into regions() of the region of addr, -1 if unmapped
+    int regionIndex(Word_t addr) const {
+        return m_pageRegion[addr >> PageShift] - 1;
+    }
+
+    // ROM and device accesses of up to 4 bytes within one region. false
+    // for anything else, writes to ROM included. RAM is left to Memory
+    bool read(Word_t addr, int numOfBytes, Word_t &data);
+    bool write(Word_t addr, int numOfBytes, Word_t data);
+    // instruction fetch from ROM
+    bool fetch(Word_t addr, Word_t &bits) const;
+
+    void print() const;
+
+private:
+    bool add(Region r);
+    void indexPages(const Region &r, uint8_t value);
 };
-}
\ No newline at end of file
+}  // namespace remu
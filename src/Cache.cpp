@@ -0,0 +1,622 @@
+#include "Cache.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace remu {
+namespace {
+bool isPowerOf2(uint32_t v) { return v != 0 && (v & (v - 1)) == 0; }
+
+uint32_t log2Of(uint32_t v) { return 31 - __builtin_clz(v); }
+}  // namespace
+
+bool CacheConfig::valid() const {
+    if (!isPowerOf2(size) || !isPowerOf2(ways) || !isPowerOf2(lineSize) ||
+        lineSize < 8) {
+        return false;
+    }
+    if (uint64_t{ways} * lineSize > size) {
+        return false;
+    }
+    return replacement != Replacement::Plru || ways <= 64;
+}
+
+bool parseCacheConfig(const char *arg, CacheConfig &c) {
+    uint32_t *fields[] = {&c.size, &c.ways, &c.lineSize};
+    const char *p = arg;
+    for (uint32_t *field : fields) {
+        char *end;
+        unsigned long v = std::strtoul(p, &end, 0);
+        if (field == &c.size && end != p && (*end == 'K' || *end == 'M')) {
+            v <<= *end == 'K' ? 10 : 20;
+            ++end;
+        }
+        if (end != p) {
+            *field = v;
+        }
+        if (*end == '\0') {
+            return c.valid();
+        }
+        if (*end != ',') {
+            return false;
+        }
+        p = end + 1;
+    }
+    // the policies, in any order
+    while (true) {
+        const char *end = std::strchr(p, ',');
+        size_t len = end != nullptr ? end - p : std::strlen(p);
+        auto is = [&](const char *name) {
+            return std::strlen(name) == len && std::strncmp(p, name, len) == 0;
+        };
+        if (is("lru")) {
+            c.replacement = Replacement::Lru;
+        } else if (is("plru")) {
+            c.replacement = Replacement::Plru;
+        } else if (is("random")) {
+            c.replacement = Replacement::Random;
+        } else if (is("wb")) {
+            c.write = WritePolicy::WriteBack;
+        } else if (is("wt")) {
+            c.write = WritePolicy::WriteThrough;
+        } else if (len != 0) {
+            return false;
+        }
+        if (end == nullptr) {
+            return c.valid();
+        }
+        p = end + 1;
+    }
+}
+
+bool HierarchyConfig::valid() const {
+    if (!l1i.valid() || !l1d.valid() || !l2.valid() ||
+        (hasL3 && !l3.valid())) {
+        return false;
+    }
+    if (l1i.lineSize != l2.lineSize || l1d.lineSize != l2.lineSize ||
+        (hasL3 && l3.lineSize != l2.lineSize)) {
+        return false;
+    }
+    // writes through an exclusive L1 would bring its lines in below
+    if (inclusion == Inclusion::Exclusive &&
+        l1d.write != WritePolicy::WriteBack) {
+        return false;
+    }
+    return l2.write == WritePolicy::WriteBack &&
+           (!hasL3 || l3.write == WritePolicy::WriteBack);
+}
+
+bool parseHierarchyPolicy(const char *arg, HierarchyConfig &c) {
+    const char *p = arg;
+    while (true) {
+        const char *end = std::strchr(p, ',');
+        size_t len = end != nullptr ? end - p : std::strlen(p);
+        auto is = [&](const char *name) {
+            return std::strlen(name) == len && std::strncmp(p, name, len) == 0;
+        };
+        if (is("inclusive")) {
+            c.inclusion = Inclusion::Inclusive;
+        } else if (is("exclusive")) {
+            c.inclusion = Inclusion::Exclusive;
+        } else if (is("nine")) {
+            c.inclusion = Inclusion::NonInclusive;
+        } else if (is("msi")) {
+            c.coherence = Coherence::Msi;
+        } else if (is("mesi")) {
+            c.coherence = Coherence::Mesi;
+        } else if (len != 0) {
+            return false;
+        }
+        if (end == nullptr) {
+            return true;
+        }
+        p = end + 1;
+    }
+}
+
+CacheStats &CacheStats::operator+=(const CacheStats &s) {
+    reads += s.reads;
+    readMisses += s.readMisses;
+    writes += s.writes;
+    writeMisses += s.writeMisses;
+    evictions += s.evictions;
+    writebacks += s.writebacks;
+    writeThroughs += s.writeThroughs;
+    return *this;
+}
+
+Cache::Cache(const CacheConfig &config, size_t regions)
+    : m_config(config),
+      m_lineShift(log2Of(config.lineSize)),
+      m_setMask(config.size / config.lineSize / config.ways - 1),
+      m_ways(config.ways),
+      m_tags(size_t{config.size / config.lineSize}, 0),
+      m_plru(config.replacement == Replacement::Plru ? m_setMask + 1 : 0, 0),
+      m_random(0x9e3779b9),
+      m_stats(regions + 1) {}
+
+uint32_t Cache::victimOf(uint32_t set, const uint32_t *ways) {
+    // LRU keeps invalid ways at the end, the others take one first
+    if (m_config.replacement == Replacement::Lru) {
+        return m_ways - 1;
+    }
+    for (uint32_t w = 0; w < m_ways; ++w) {
+        if ((ways[w] & LineValid) == 0) {
+            return w;
+        }
+    }
+    switch (m_config.replacement) {
+        case Replacement::Plru: {
+            // follow the bits down to the older half at each level
+            uint64_t bits = m_plru[set];
+            uint32_t node = 1;
+            while (node < m_ways) {
+                node = 2 * node + ((bits >> node) & 1);
+            }
+            return node - m_ways;
+        }
+        case Replacement::Random:
+        default:
+            // xorshift32
+            m_random ^= m_random << 13;
+            m_random ^= m_random >> 17;
+            m_random ^= m_random << 5;
+            return m_random & (m_ways - 1);
+    }
+}
+
+void Cache::touch(uint32_t set, uint32_t way) {
+    if (m_config.replacement != Replacement::Plru) {
+        return;
+    }
+    // point every node on the path away from way
+    uint64_t &bits = m_plru[set];
+    for (uint32_t node = way + m_ways; node > 1; node >>= 1) {
+        uint64_t bit = uint64_t{1} << (node >> 1);
+        if (node & 1) {
+            bits &= ~bit;
+        } else {
+            bits |= bit;
+        }
+    }
+}
+
+int Cache::find(Word_t paddr) const {
+    uint32_t line = paddr >> m_lineShift;
+    uint32_t base = (line & m_setMask) * m_ways;
+    uint32_t tag = line | LineValid;
+    for (uint32_t w = 0; w < m_ways; ++w) {
+        if ((m_tags[base + w] & ~(LineDirty | LineShared)) == tag) {
+            return base + w;
+        }
+    }
+    return -1;
+}
+
+int Cache::use(int slot) {
+    uint32_t set = slot / m_ways;
+    uint32_t w = slot % m_ways;
+    if (m_config.replacement != Replacement::Lru) {
+        touch(set, w);
+        return slot;
+    }
+    // move it to the front, what was before it moves up one way
+    uint32_t *ways = &m_tags[size_t{set} * m_ways];
+    uint32_t tag = ways[w];
+    for (; w > 0; --w) {
+        ways[w] = ways[w - 1];
+    }
+    ways[0] = tag;
+    return set * m_ways;
+}
+
+Cache::Line Cache::insert(Word_t paddr, uint32_t flags) {
+    uint32_t line = paddr >> m_lineShift;
+    uint32_t set = line & m_setMask;
+    uint32_t *ways = &m_tags[size_t{set} * m_ways];
+    uint32_t tag = line | LineValid | flags;
+    uint32_t w = victimOf(set, ways);
+    uint32_t old = ways[w];
+    if (m_config.replacement == Replacement::Lru) {
+        for (; w > 0; --w) {
+            ways[w] = ways[w - 1];
+        }
+    } else {
+        touch(set, w);
+    }
+    ways[w] = tag;
+    return lineOfTag(old);
+}
+
+Cache::Line Cache::remove(Word_t paddr) {
+    int slot = find(paddr);
+    if (slot < 0) {
+        return Line{0, 0};
+    }
+    uint32_t old = m_tags[slot];
+    if (m_config.replacement == Replacement::Lru) {
+        // keep the invalid way at the end
+        uint32_t last = (slot / m_ways + 1) * m_ways - 1;
+        for (uint32_t i = slot; i < last; ++i) {
+            m_tags[i] = m_tags[i + 1];
+        }
+        m_tags[last] = 0;
+    } else {
+        m_tags[slot] = 0;
+    }
+    return lineOfTag(old);
+}
+
+void Cache::invalidate() {
+    std::fill(m_tags.begin(), m_tags.end(), 0);
+    std::fill(m_plru.begin(), m_plru.end(), 0);
+}
+
+void Cache::resetStats() {
+    std::fill(m_stats.begin(), m_stats.end(), CacheStats{});
+}
+
+CacheStats Cache::total() const {
+    CacheStats t;
+    for (const CacheStats &s : m_stats) {
+        t += s;
+    }
+    return t;
+}
+
+namespace {
+void printStats(const char *name, const CacheStats &s) {
+    uint64_t accesses = s.reads + s.writes;
+    uint64_t misses = s.readMisses + s.writeMisses;
+    double rate = accesses != 0 ? 100.0 * misses / accesses : 0.0;
+    std::printf("  %-8s %12" PRIu64 " accesses %10" PRIu64
+                " misses (%.3f%%) %10" PRIu64 " evictions %10" PRIu64
+                " writebacks\n",
+                name, accesses, misses, rate, s.evictions, s.writebacks);
+}
+
+void printCache(const char *name, const Cache &c, const Bus &bus) {
+    const CacheConfig &k = c.config();
+    static const char *const replacements[] = {"lru", "plru", "random"};
+    std::printf("%s: %u KiB, %u ways, %u byte lines, %s, %s\n", name,
+                k.size >> 10, k.ways, k.lineSize,
+                replacements[static_cast<int>(k.replacement)],
+                k.write == WritePolicy::WriteBack ? "write-back"
+                                                  : "write-through");
+    const std::vector<Region> &regions = bus.regions();
+    for (int i = -1; i < static_cast<int>(regions.size()); ++i) {
+        const CacheStats &s = c.stats(i);
+        if (s.reads + s.writes != 0) {
+            printStats(i < 0 ? "unmapped" : regions[i].name.data(), s);
+        }
+    }
+    printStats("total", c.total());
+}
+}  // namespace
+
+void CachePort::fetch(Word_t paddr) { m_caches.fetch(m_hart, paddr); }
+
+void CachePort::read(Word_t paddr, int numOfBytes) {
+    m_caches.read(m_hart, paddr, numOfBytes);
+}
+
+void CachePort::write(Word_t paddr, int numOfBytes) {
+    m_caches.write(m_hart, paddr, numOfBytes);
+}
+
+CacheHierarchy::CacheHierarchy(const Bus &bus, const HierarchyConfig &config,
+                               int harts)
+    : m_bus(bus), m_config(config) {
+    size_t regions = bus.regions().size();
+    m_cores.reserve(harts);
+    m_ports.reserve(harts);
+    for (int i = 0; i < harts; ++i) {
+        m_cores.push_back(Core{ICache(config.l1i, regions),
+                               DCache(config.l1d, regions)});
+        m_ports.emplace_back(*this, i);
+    }
+    m_lower.emplace_back(config.l2, regions);
+    if (config.hasL3) {
+        m_lower.emplace_back(config.l3, regions);
+    }
+}
+
+void CacheHierarchy::fetch(int hart, Word_t paddr) {
+    int region = m_bus.regionIndex(paddr);
+    ICache &c = m_cores[hart].icache;
+    CacheStats &s = c.statsOf(region);
+    ++s.reads;
+    int slot = c.find(paddr);
+    if (slot >= 0) [[likely]] {
+        c.use(slot);
+        return;
+    }
+    ++s.readMisses;
+    // code is never written, a dirty line stays below
+    fill(0, paddr, region, false, false);
+    retire(c, -1, c.insert(paddr, 0));
+}
+
+void CacheHierarchy::read(int hart, Word_t paddr, int numOfBytes) {
+    int region = m_bus.regionIndex(paddr);
+    access(hart, paddr, false, region);
+    Word_t last = paddr + numOfBytes - 1;
+    if (m_cores[hart].dcache.lineOf(last) != m_cores[hart].dcache.lineOf(
+                                                 paddr)) [[unlikely]] {
+        access(hart, last, false, region);
+    }
+}
+
+void CacheHierarchy::write(int hart, Word_t paddr, int numOfBytes) {
+    int region = m_bus.regionIndex(paddr);
+    access(hart, paddr, true, region);
+    Word_t last = paddr + numOfBytes - 1;
+    if (m_cores[hart].dcache.lineOf(last) != m_cores[hart].dcache.lineOf(
+                                                 paddr)) [[unlikely]] {
+        access(hart, last, true, region);
+    }
+}
+
+void CacheHierarchy::access(int hart, Word_t paddr, bool write, int region) {
+    DCache &c = m_cores[hart].dcache;
+    CacheStats &s = c.statsOf(region);
+    bool writeBack = c.config().write == WritePolicy::WriteBack;
+    if (write) {
+        ++s.writes;
+    } else {
+        ++s.reads;
+    }
+    int slot = c.find(paddr);
+    if (slot >= 0) [[likely]] {
+        slot = c.use(slot);
+        if (!write) {
+            return;
+        }
+        // other copies go before the line is written
+        uint32_t flags = c.flagsAt(slot);
+        if (flags & LineShared) {
+            ++m_stats.upgrades;
+            snoop(hart, paddr, true, region);
+            c.setFlags(slot, 0, LineShared);
+        } else if (writeBack && !(flags & LineDirty)) {
+            // a write-through line stays clean, and never changes state
+            ++m_stats.silentUpgrades;
+        }
+        if (writeBack) {
+            c.setFlags(slot, LineDirty, 0);
+        } else {
+            ++s.writeThroughs;
+            writeLine(0, paddr, region);
+        }
+        return;
+    }
+
+    // a lone hart has nothing to snoop, and puts nothing on the bus
+    bool snooped = m_cores.size() > 1;
+    if (write) {
+        ++s.writeMisses;
+        m_stats.busReadXs += snooped;
+    } else {
+        ++s.readMisses;
+        m_stats.busReads += snooped;
+    }
+    bool shared = snoop(hart, paddr, write, region);
+    // write-through caches do not allocate on a write miss
+    if (write && !writeBack) {
+        ++s.writeThroughs;
+        writeLine(0, paddr, region);
+        return;
+    }
+    uint32_t flags = fill(0, paddr, region, true, write);
+    if (write) {
+        flags = writeBack ? LineDirty : 0;
+    } else if (shared || m_config.coherence == Coherence::Msi) {
+        flags |= LineShared;
+    }
+    retire(c, -1, c.insert(paddr, flags));
+}
+
+bool CacheHierarchy::snoop(int hart, Word_t paddr, bool write, int region) {
+    bool kept = false;
+    for (int i = 0; i < static_cast<int>(m_cores.size()); ++i) {
+        if (i == hart) {
+            continue;
+        }
+        DCache &c = m_cores[i].dcache;
+        int slot = c.find(paddr);
+        if (slot < 0) {
+            continue;
+        }
+        uint32_t flags = c.flagsAt(slot);
+        if (flags & LineDirty) {
+            ++m_stats.interventions;
+        }
+        if (write) {
+            // the writer takes the data, dirty or not
+            c.remove(paddr);
+            ++m_stats.invalidations;
+            continue;
+        }
+        // the dirty copy is written back, except that nothing below an
+        // exclusive L1 may hold it, so there it stays dirty and shared
+        if ((flags & LineDirty) &&
+            m_config.inclusion != Inclusion::Exclusive) {
+            writeLine(0, paddr, region);
+            c.setFlags(slot, LineShared, LineDirty);
+        } else {
+            c.setFlags(slot, LineShared, 0);
+        }
+        kept = true;
+    }
+    return kept;
+}
+
+uint32_t CacheHierarchy::fill(size_t level, Word_t paddr, int region,
+                              bool take, bool write) {
+    if (level == m_lower.size()) {
+        ++m_stats.memReads;
+        m_stats.writeFills[2] += write;
+        return 0;
+    }
+    Cache &c = m_lower[level];
+    CacheStats &s = c.statsOf(region);
+    bool exclusive = m_config.inclusion == Inclusion::Exclusive;
+    ++s.reads;
+    ++m_stats.lowerReads[level];
+    m_stats.writeFills[level] += write;
+    int slot = c.find(paddr);
+    if (slot >= 0) {
+        uint32_t flags = c.flagsAt(slot) & LineDirty;
+        // an exclusive level hands the line up, unless it is dirty and
+        // the upper level cannot take that
+        if (!exclusive || (flags && !take)) {
+            c.use(slot);
+            return 0;
+        }
+        c.remove(paddr);
+        return flags;
+    }
+    ++s.readMisses;
+    uint32_t flags = fill(level + 1, paddr, region, take, write);
+    // lines only pass an exclusive level on their way up
+    if (exclusive) {
+        return flags;
+    }
+    retire(c, level, c.insert(paddr, flags));
+    return 0;
+}
+
+void CacheHierarchy::writeLine(size_t level, Word_t paddr, int region) {
+    if (level == m_lower.size()) {
+        ++m_stats.memWrites;
+        return;
+    }
+    Cache &c = m_lower[level];
+    CacheStats &s = c.statsOf(region);
+    ++s.writes;
+    int slot = c.find(paddr);
+    if (slot >= 0) {
+        c.setFlags(slot, LineDirty, 0);
+        return;
+    }
+    ++s.writeMisses;
+    retire(c, level, c.insert(paddr, LineDirty));
+}
+
+void CacheHierarchy::retire(Cache &c, int level, Cache::Line victim) {
+    if (!(victim.flags & LineValid)) {
+        return;
+    }
+    // counted against the region of the line, not of the access that
+    // evicted it
+    int region = m_bus.regionIndex(victim.addr);
+    CacheStats &s = c.statsOf(region);
+    ++s.evictions;
+    if (level >= 0 && m_config.inclusion == Inclusion::Inclusive) {
+        victim.flags |= dropAbove(level, victim.addr) & LineDirty;
+    }
+    size_t below = level + 1;
+    if (m_config.inclusion != Inclusion::Exclusive) {
+        if (victim.flags & LineDirty) {
+            ++s.writebacks;
+            writeLine(below, victim.addr, region);
+        }
+        return;
+    }
+    // exclusive levels take every line evicted above them
+    if (below == m_lower.size()) {
+        if (victim.flags & LineDirty) {
+            ++s.writebacks;
+            ++m_stats.memWrites;
+        }
+        return;
+    }
+    Cache &next = m_lower[below];
+    uint32_t dirty = victim.flags & LineDirty;
+    if (dirty) {
+        ++s.writebacks;
+        ++next.statsOf(region).writes;
+    }
+    int slot = next.find(victim.addr);
+    if (slot >= 0) {
+        // the other L1 evicted it already
+        next.setFlags(next.use(slot), dirty, 0);
+        return;
+    }
+    retire(next, below, next.insert(victim.addr, dirty));
+}
+
+uint32_t CacheHierarchy::dropAbove(size_t level, Word_t line) {
+    uint32_t flags = 0;
+    auto drop = [&](Cache &c) {
+        Cache::Line l = c.remove(line);
+        if (l.flags != 0) {
+            ++m_stats.backInvalidations;
+            flags |= l.flags;
+        }
+    };
+    for (Core &core : m_cores) {
+        drop(core.icache);
+        drop(core.dcache);
+    }
+    for (size_t i = 0; i < level; ++i) {
+        drop(m_lower[i]);
+    }
+    return flags;
+}
+
+CacheHierarchy::Mpki CacheHierarchy::mpki(uint64_t instructions) const {
+    Mpki m{};
+    if (instructions == 0) {
+        return m;
+    }
+    double scale = 1000.0 / instructions;
+    for (const Core &core : m_cores) {
+        m.l1i += core.icache.total().misses() * scale;
+        m.l1d += core.dcache.total().misses() * scale;
+    }
+    m.l2 = m_lower[0].total().misses() * scale;
+    if (m_lower.size() > 1) {
+        m.l3 = m_lower[1].total().misses() * scale;
+    }
+    return m;
+}
+
+void CacheHierarchy::print(uint64_t instructions) const {
+    static const char *const inclusions[] = {"inclusive", "exclusive",
+                                             "non-inclusive"};
+    std::printf("%s, %s\n",
+                inclusions[static_cast<int>(m_config.inclusion)],
+                m_config.coherence == Coherence::Msi ? "msi" : "mesi");
+    for (size_t i = 0; i < m_cores.size(); ++i) {
+        std::string hart =
+            m_cores.size() > 1 ? "hart " + std::to_string(i) + " " : "";
+        printCache((hart + "l1i").data(), m_cores[i].icache, m_bus);
+        printCache((hart + "l1d").data(), m_cores[i].dcache, m_bus);
+    }
+    printCache("l2", m_lower[0], m_bus);
+    if (m_lower.size() > 1) {
+        printCache("l3", m_lower[1], m_bus);
+    }
+
+    Mpki m = mpki(instructions);
+    std::printf("mpki: l1i %.3f, l1d %.3f, l2 %.3f", m.l1i, m.l1d, m.l2);
+    if (m_lower.size() > 1) {
+        std::printf(", l3 %.3f", m.l3);
+    }
+    std::printf(" over %" PRIu64 " insts\n", instructions);
+    const HierarchyStats &s = m_stats;
+    std::printf("bus:  %" PRIu64 " reads, %" PRIu64 " read-exclusives, %" PRIu64
+                " upgrades, %" PRIu64 " silent upgrades\n",
+                s.busReads, s.busReadXs, s.upgrades, s.silentUpgrades);
+    std::printf("      %" PRIu64 " invalidations, %" PRIu64
+                " interventions, %" PRIu64 " back-invalidations\n",
+                s.invalidations, s.interventions, s.backInvalidations);
+    std::printf("mem:  %" PRIu64 " line reads, %" PRIu64 " writes\n",
+                s.memReads, s.memWrites);
+}
+}  // namespace remu
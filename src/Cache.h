@@ -1,12 +1,271 @@
 #pragma once
 
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Bus.h"
+#include "ISA.h"
+#include "Memory.h"
+
 namespace remu {
+enum class Replacement : uint8_t { Lru, Plru, Random };
+enum class WritePolicy : uint8_t {
+    WriteBack,    // dirty lines go to the next level when evicted
+    WriteThrough  // every write goes to the next level, misses allocate none
+};
+
+struct CacheConfig {
+    uint32_t size = 32u << 10;  // bytes
+    uint32_t ways = 8;
+    uint32_t lineSize = 64;
+    Replacement replacement = Replacement::Lru;
+    WritePolicy write = WritePolicy::WriteBack;
+
+    // all powers of two, lines of at least 8 bytes, at least one set, and
+    // no more than 64 ways for the PLRU tree
+    bool valid() const;
+};
 
-class ICache {
-    
+// "size,ways,line[,lru|plru|random][,wb|wt]", size may end in K or M.
+// empty fields keep their value
+bool parseCacheConfig(const char *arg, CacheConfig &c);
+
+struct CacheStats {
+    uint64_t reads = 0;
+    uint64_t readMisses = 0;
+    uint64_t writes = 0;
+    uint64_t writeMisses = 0;
+    uint64_t evictions = 0;      // valid lines replaced
+    uint64_t writebacks = 0;     // dirty lines written to the next level
+    uint64_t writeThroughs = 0;  // writes passed on to the next level
+
+    uint64_t misses() const { return readMisses + writeMisses; }
+    CacheStats &operator+=(const CacheStats &s);
+};
+
+// state of a line, kept in its tag word beside the line address. a valid
+// line that is neither dirty nor shared is exclusive, see CacheHierarchy
+enum LineFlag : uint32_t {
+    LineValid = 1u << 31,
+    LineDirty = 1u << 30,
+    LineShared = 1u << 29,
 };
 
-class DCache {
+// one set-associative cache. the lines of a set are consecutive words of
+// a flat tag array, each the line address with its LineFlags, so a lookup
+// scans a few words and no line is an object. under LRU the set is kept
+// in recency order, most recent first, and the victim is the last way.
+// PLRU keeps a tree of ways - 1 bits per set
+class Cache {
+public:
+    // a line taken out of the cache, flags 0 if there was none
+    struct Line {
+        Word_t addr;
+        uint32_t flags;
+    };
+
+private:
+    static constexpr uint32_t FlagMask = LineValid | LineDirty | LineShared;
+
+    CacheConfig m_config;
+    uint32_t m_lineShift;
+    uint32_t m_setMask;
+    uint32_t m_ways;
+    std::vector<uint32_t> m_tags;
+    std::vector<uint64_t> m_plru;
+    uint32_t m_random;
+    // by bus region, see Bus::regionIndex, one up so that unmapped
+    // addresses count in the first
+    std::vector<CacheStats> m_stats;
+
+    uint32_t victimOf(uint32_t set, const uint32_t *ways);
+    void touch(uint32_t set, uint32_t way);
+    Line lineOfTag(uint32_t tag) const {
+        return Line{(tag & ~FlagMask) << m_lineShift, tag & FlagMask};
+    }
+
+public:
+    // config must be valid
+    Cache(const CacheConfig &config, size_t regions);
+    ~Cache() = default;
+
+    const CacheConfig &config() const { return m_config; }
+    Word_t lineOf(Word_t paddr) const {
+        return paddr & ~((1u << m_lineShift) - 1);
+    }
+
+    // line by line, the hierarchy drives them. none of these count
+    // anything, the caller does.
+    // slot of the line holding paddr, -1 if absent
+    int find(Word_t paddr) const;
+    uint32_t flagsAt(int slot) const { return m_tags[slot] & FlagMask; }
+    void setFlags(int slot, uint32_t set, uint32_t clear) {
+        m_tags[slot] = (m_tags[slot] | set) & ~clear;
+    }
+    // make the line in slot the most recently used, returns its new slot
+    int use(int slot);
+    // bring in the absent line of paddr as the most recently used, with
+    // flags besides LineValid. returns the line it replaced
+    Line insert(Word_t paddr, uint32_t flags);
+    // take the line of paddr out
+    Line remove(Word_t paddr);
+
+    // drop every line, dirty ones without a writeback
+    void invalidate();
+    void resetStats();
+
+    // of region, -1 for unmapped addresses, and of all regions together
+    CacheStats &statsOf(int region) { return m_stats[region + 1]; }
+    const CacheStats &stats(int region) const { return m_stats[region + 1]; }
+    CacheStats total() const;
+};
+
+// the L1 caches of one hart
+class ICache : public Cache {
+public:
+    using Cache::Cache;
+};
+
+class DCache : public Cache {
+public:
+    using Cache::Cache;
+};
+
+// which lines of an upper level the lower levels hold too
+enum class Inclusion : uint8_t {
+    Inclusive,    // all of them, a lower eviction drops the upper copies
+    Exclusive,    // none, lower levels only take what the upper evict
+    NonInclusive  // whatever they happened to keep
+};
+
+// how the L1 data caches of several harts keep their copies coherent.
+// MESI reads into an exclusive line where no other hart has one, which
+// saves the upgrade on a later write
+enum class Coherence : uint8_t { Msi, Mesi };
+
+struct HierarchyConfig {
+    CacheConfig l1i;
+    CacheConfig l1d;
+    CacheConfig l2{.size = 256u << 10};
+    CacheConfig l3{.size = 2u << 20, .ways = 16};
+    bool hasL3 = false;
+    Inclusion inclusion = Inclusion::NonInclusive;
+    Coherence coherence = Coherence::Mesi;
+
+    // every level valid, all with the same line size, L2 and L3
+    // write-back, and the L1D too if exclusive
+    bool valid() const;
+};
+
+// "inclusive|exclusive|nine[,msi|mesi]", empty fields keep their value
+bool parseHierarchyPolicy(const char *arg, HierarchyConfig &c);
+
+// traffic between the L1 data caches of the harts, and below them
+struct HierarchyStats {
+    uint64_t busReads = 0;        // read misses snooped by the other L1Ds
+    uint64_t busReadXs = 0;       // write misses, which take every copy
+    uint64_t upgrades = 0;        // writes to a shared line
+    // first writes to an exclusive line in a write-back L1D
+    uint64_t silentUpgrades = 0;
+    uint64_t invalidations = 0;   // copies taken from other L1Ds
+    uint64_t interventions = 0;   // dirty lines supplied by another L1D
+    uint64_t backInvalidations = 0;  // upper copies of lines evicted below
+    uint64_t lowerReads[2] = {};     // lines asked of the L2 and the L3
+    uint64_t memReads = 0;           // lines read from memory
+    // of those, the lines L1D write misses asked of the L2, the L3 and
+    // memory, which a write buffer hides from the hart
+    uint64_t writeFills[3] = {};
+    uint64_t memWrites = 0;          // lines written to memory
+};
+
+class CacheHierarchy;
+
+// what one hart's Memory is observed by, see Memory::setObserver
+class CachePort : public AccessObserver {
+private:
+    CacheHierarchy &m_caches;
+    int m_hart;
+
+public:
+    CachePort(CacheHierarchy &caches, int hart)
+        : m_caches(caches), m_hart(hart) {}
+    ~CachePort() override = default;
+
+    void fetch(Word_t paddr) override;
+    void read(Word_t paddr, int numOfBytes) override;
+    void write(Word_t paddr, int numOfBytes) override;
+};
+
+// split L1s per hart over a unified L2 and an optional L3, both shared.
+// accesses come in through each hart's port by physical address. loads
+// and stores outside RAM are uncached and never reach it, fetches from
+// ROM do. built once the bus has all its regions
+class CacheHierarchy {
+private:
+    struct Core {
+        ICache icache;
+        DCache dcache;
+    };
+
+    const Bus &m_bus;
+    HierarchyConfig m_config;
+    std::vector<Core> m_cores;
+    // L2, then L3
+    std::vector<Cache> m_lower;
+    std::vector<CachePort> m_ports;
+    HierarchyStats m_stats;
+
+    void access(int hart, Word_t paddr, bool write, int region);
+    // snoop the other harts' L1Ds for a miss or upgrade of hart. true if
+    // any of them keeps a copy
+    bool snoop(int hart, Word_t paddr, bool write, int region);
+    // a miss above level, an index into m_lower or memory past its end,
+    // for a write miss if write. returns LineDirty if a dirty line comes
+    // up, which only an exclusive level hands over, and only if take
+    uint32_t fill(size_t level, Word_t paddr, int region, bool take,
+                  bool write);
+    // a dirty line, or a word written through, goes into level
+    void writeLine(size_t level, Word_t paddr, int region);
+    // victim was replaced in c, at level or in an L1 for -1, and goes
+    // below it
+    void retire(Cache &c, int level, Cache::Line victim);
+    // an inclusive level evicted line, which leaves everything above it
+    // too. returns the flags of the upper copies
+    uint32_t dropAbove(size_t level, Word_t line);
+
+public:
+    // config must be valid
+    CacheHierarchy(const Bus &bus, const HierarchyConfig &config,
+                   int harts = 1);
+    ~CacheHierarchy() = default;
+    CacheHierarchy(const CacheHierarchy &) = delete;
+    CacheHierarchy &operator=(const CacheHierarchy &) = delete;
+
+    const HierarchyConfig &config() const { return m_config; }
+    CachePort &port(int hart) { return m_ports[hart]; }
+
+    void fetch(int hart, Word_t paddr);
+    void read(int hart, Word_t paddr, int numOfBytes);
+    void write(int hart, Word_t paddr, int numOfBytes);
+
+    ICache &icache(int hart) { return m_cores[hart].icache; }
+    DCache &dcache(int hart) { return m_cores[hart].dcache; }
+    // L2, then L3 if there is one
+    size_t lowerLevels() const { return m_lower.size(); }
+    Cache &lower(size_t level) { return m_lower[level]; }
+    const HierarchyStats &stats() const { return m_stats; }
+
+    // misses per thousand instructions of each level, the L1s summed over
+    // the harts. 0 for a missing L3
+    struct Mpki {
+        double l1i;
+        double l1d;
+        double l2;
+        double l3;
+    };
+    Mpki mpki(uint64_t instructions) const;
 
+    void print(uint64_t instructions) const;
 };
-}  // namespace remu
\ No newline at end of file
+}  // namespace remu
@@ -0,0 +1,195 @@
+#include "CacheSweep.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <sstream>
+
+namespace remu {
+namespace {
+std::string describe(const CacheConfig &c, bool writePolicy) {
+    static const char *const replacements[] = {"lru", "plru", "random"};
+    std::string size = c.size % (1u << 20) == 0
+                           ? std::to_string(c.size >> 20) + "M"
+                       : c.size % (1u << 10) == 0
+                           ? std::to_string(c.size >> 10) + "K"
+                           : std::to_string(c.size);
+    std::string s = size + "," + std::to_string(c.ways) + "," +
+                    std::to_string(c.lineSize) + "," +
+                    replacements[static_cast<int>(c.replacement)];
+    if (writePolicy) {
+        s += c.write == WritePolicy::WriteBack ? ",wb" : ",wt";
+    }
+    return s;
+}
+}  // namespace
+
+bool parseHierarchyConfig(const std::string &line, HierarchyConfig &c) {
+    std::istringstream in(line);
+    std::string field;
+    while (in >> field) {
+        size_t eq = field.find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        std::string key = field.substr(0, eq);
+        const char *value = field.data() + eq + 1;
+        bool ok;
+        if (key == "l1i") {
+            ok = parseCacheConfig(value, c.l1i);
+        } else if (key == "l1d") {
+            ok = parseCacheConfig(value, c.l1d);
+        } else if (key == "l2") {
+            ok = parseCacheConfig(value, c.l2);
+        } else if (key == "l3") {
+            ok = parseCacheConfig(value, c.l3);
+            c.hasL3 = true;
+        } else if (key == "policy") {
+            ok = parseHierarchyPolicy(value, c);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return c.valid();
+}
+
+std::string describe(const HierarchyConfig &c) {
+    static const char *const inclusions[] = {"inclusive", "exclusive",
+                                             "nine"};
+    std::string s = "l1i=" + describe(c.l1i, false) +
+                    " l1d=" + describe(c.l1d, true) +
+                    " l2=" + describe(c.l2, false);
+    if (c.hasL3) {
+        s += " l3=" + describe(c.l3, false);
+    }
+    s += std::string(" policy=") +
+         inclusions[static_cast<int>(c.inclusion)] +
+         (c.coherence == Coherence::Msi ? ",msi" : ",mesi");
+    return s;
+}
+
+CacheSweep::CacheSweep(const Bus &bus, std::vector<HierarchyConfig> configs,
+                       unsigned threads)
+    : m_configs(std::move(configs)),
+      m_ring(RingSize),
+      m_published(0),
+      m_stop(false),
+      m_batch(&m_ring[0]) {
+    m_batch->count = 0;
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min<size_t>(threads, m_configs.size());
+    for (unsigned i = 0; i < threads; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+    // round robin, so that each worker gets its share of the big ones
+    for (size_t i = 0; i < m_configs.size(); ++i) {
+        m_workers[i % threads]->caches.push_back(
+            std::make_unique<CacheHierarchy>(bus, m_configs[i]));
+    }
+    for (auto &w : m_workers) {
+        w->thread = std::thread([this, worker = w.get()] { work(*worker); });
+    }
+}
+
+CacheSweep::~CacheSweep() {
+    m_stop.store(true, std::memory_order_release);
+    for (auto &w : m_workers) {
+        w->thread.join();
+    }
+}
+
+void CacheSweep::work(Worker &w) {
+    uint64_t next = w.consumed.load(std::memory_order_relaxed);
+    int idle = 0;
+    while (true) {
+        if (next == m_published.load(std::memory_order_acquire)) {
+            if (m_stop.load(std::memory_order_acquire)) {
+                return;
+            }
+            // the run may sit in the debugger for long, stop spinning
+            if (++idle < 64) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+            continue;
+        }
+        idle = 0;
+        // a whole batch per hierarchy, which keeps its tags in the host
+        // caches
+        const Batch &b = m_ring[next % RingSize];
+        for (auto &caches : w.caches) {
+            for (uint32_t i = 0; i < b.count; ++i) {
+                const Access &a = b.accesses[i];
+                switch (a.type) {
+                    case AccessType::Fetch:
+                        caches->fetch(0, a.paddr);
+                        break;
+                    case AccessType::Read:
+                        caches->read(0, a.paddr, a.numOfBytes);
+                        break;
+                    case AccessType::Write:
+                        caches->write(0, a.paddr, a.numOfBytes);
+                        break;
+                }
+            }
+        }
+        w.consumed.store(++next, std::memory_order_release);
+    }
+}
+
+void CacheSweep::publish() {
+    uint64_t next = m_published.load(std::memory_order_relaxed) + 1;
+    m_published.store(next, std::memory_order_release);
+    // the slot of the next batch last held batch next - RingSize, which
+    // every worker must be done with
+    for (auto &w : m_workers) {
+        while (w->consumed.load(std::memory_order_acquire) + RingSize <=
+               next) {
+            std::this_thread::yield();
+        }
+    }
+    m_batch = &m_ring[next % RingSize];
+    m_batch->count = 0;
+}
+
+void CacheSweep::sync() {
+    if (m_batch->count != 0) {
+        publish();
+    }
+    uint64_t published = m_published.load(std::memory_order_relaxed);
+    for (auto &w : m_workers) {
+        while (w->consumed.load(std::memory_order_acquire) != published) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+const CacheHierarchy &CacheSweep::caches(size_t i) const {
+    return *m_workers[i % m_workers.size()]->caches[i / m_workers.size()];
+}
+
+void CacheSweep::print(uint64_t instructions) {
+    sync();
+    std::printf("%zu configs on %zu threads, over %" PRIu64 " insts\n",
+                m_configs.size(), m_workers.size(), instructions);
+    for (size_t i = 0; i < m_configs.size(); ++i) {
+        const CacheHierarchy &c = caches(i);
+        CacheHierarchy::Mpki m = c.mpki(instructions);
+        std::printf("%3zu: mpki l1i %7.3f l1d %7.3f l2 %7.3f", i, m.l1i,
+                    m.l1d, m.l2);
+        if (m_configs[i].hasL3) {
+            std::printf(" l3 %7.3f", m.l3);
+        }
+        std::printf(", mem %" PRIu64 "/%" PRIu64 "  %s\n",
+                    c.stats().memReads, c.stats().memWrites,
+                    describe(m_configs[i]).data());
+    }
+}
+}  // namespace remu
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Cache.h"
+#include "ISA.h"
+#include "Memory.h"
+
+namespace remu {
+// "l1i=spec l1d=spec l2=spec l3=spec policy=spec", each spec as for
+// parseCacheConfig or parseHierarchyPolicy. levels not named keep their
+// value, l3 adds an L3
+bool parseHierarchyConfig(const std::string &line, HierarchyConfig &c);
+std::string describe(const HierarchyConfig &c);
+
+// one guest run feeds its accesses to many cache hierarchies at once.
+// accesses are packed into batches in a ring, which the workers read
+// behind the run, each with a cursor of its own and a share of the
+// hierarchies. the run waits only when the slowest worker is a whole
+// ring behind
+class CacheSweep : public AccessObserver {
+private:
+    struct Access {
+        Word_t paddr;
+        AccessType type;
+        uint8_t numOfBytes;
+    };
+
+    static constexpr uint32_t BatchSize = 4096;
+    static constexpr uint64_t RingSize = 32;
+
+    struct Batch {
+        uint32_t count;
+        std::array<Access, BatchSize> accesses;
+    };
+
+    // a cursor per worker, on a host cache line of its own so that
+    // moving it does not disturb the others
+    struct alignas(64) Worker {
+        std::atomic<uint64_t> consumed{0};
+        std::vector<std::unique_ptr<CacheHierarchy>> caches;
+        std::thread thread;
+    };
+
+    std::vector<HierarchyConfig> m_configs;
+    std::vector<Batch> m_ring;
+    // batches handed to the workers. the one after them is being filled
+    alignas(64) std::atomic<uint64_t> m_published;
+    std::atomic<bool> m_stop;
+    Batch *m_batch;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    void work(Worker &w);
+    // hand the current batch over, and wait for the slot of the next one
+    // to be free
+    [[gnu::noinline]] void publish();
+    void push(Word_t paddr, AccessType type, int numOfBytes) {
+        m_batch->accesses[m_batch->count++] = {
+            paddr, type, static_cast<uint8_t>(numOfBytes)};
+        if (m_batch->count == BatchSize) [[unlikely]] {
+            publish();
+        }
+    }
+
+public:
+    // every config must be valid. threads 0 takes one per host core
+    CacheSweep(const Bus &bus, std::vector<HierarchyConfig> configs,
+               unsigned threads = 0);
+    ~CacheSweep() override;
+    CacheSweep(const CacheSweep &) = delete;
+    CacheSweep &operator=(const CacheSweep &) = delete;
+
+    void fetch(Word_t paddr) override { push(paddr, AccessType::Fetch, 4); }
+    void read(Word_t paddr, int numOfBytes) override {
+        push(paddr, AccessType::Read, numOfBytes);
+    }
+    void write(Word_t paddr, int numOfBytes) override {
+        push(paddr, AccessType::Write, numOfBytes);
+    }
+
+    // hand over what is buffered and wait for the workers to take all of
+    // it, after which the hierarchies may be read
+    void sync();
+
+    size_t size() const { return m_configs.size(); }
+    unsigned threads() const { return m_workers.size(); }
+    // the hierarchy of config i, only to be read after sync()
+    const CacheHierarchy &caches(size_t i) const;
+
+    // a line per config
+    void print(uint64_t instructions);
+};
+}  // namespace remu
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ISA.h"
+#include "Instruction.h"
+
+namespace remu {
+// direct-mapped cache of predecoded instructions keyed by guest pc.
+// an entry is reused as long as the word fetched at pc still matches the
+// bits it was decoded from, so rewritten code is simply decoded again.
+class DecodeCache {
+private:
+    static constexpr int IndexBits = 14;
+    static constexpr Word_t InvalidTag = ~0u;  // pc is always even
+
+    struct Entry {
+        Word_t pc;
+        DecodedInst inst;
+    };
+
+    std::vector<Entry> m_entries;
+
+public:
+    DecodeCache() : m_entries(1u << IndexBits, Entry{.pc = InvalidTag}) {}
+    ~DecodeCache() = default;
+
+    const DecodedInst& lookup(Word_t pc, Word_t bits) {
+        Entry& e = m_entries[(pc >> 2) & ((1u << IndexBits) - 1)];
+        if (e.pc != pc || e.inst.bits != bits) [[unlikely]] {
+            return refill(e, pc, bits);
+        }
+        return e.inst;
+    }
+
+    // the entry for pc if it is still valid, without refilling it
+    const DecodedInst* find(Word_t pc, Word_t bits) const {
+        const Entry& e = m_entries[(pc >> 2) & ((1u << IndexBits) - 1)];
+        return e.pc == pc && e.inst.bits == bits ? &e.inst : nullptr;
+    }
+
+    // have the entry for pc run h from now on, if it still holds bits
+    void rebind(Word_t pc, Word_t bits, Handler h) {
+        Entry& e = m_entries[(pc >> 2) & ((1u << IndexBits) - 1)];
+        if (e.pc == pc && e.inst.bits == bits) {
+            e.inst.handler = h;
+        }
+    }
+
+    void flush() {
+        for (auto& e : m_entries) {
+            e.pc = InvalidTag;
+        }
+    }
+
+private:
+    // out of line, so the dispatch paths that inline lookup() stay small
+    [[gnu::noinline]] static const DecodedInst& refill(Entry& e, Word_t pc,
+                                                       Word_t bits) {
+        e.inst = Instruction(bits).decode();
+        e.pc = pc;
+        return e.inst;
+    }
+};
+}  // namespace remu
@@ -0,0 +1,88 @@
+#include "HostCounters.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace {
+int openCounter(uint64_t result, int group) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+    attr.disabled = group < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return static_cast<int>(
+        syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+}
+}  // namespace
+
+namespace remu {
+HostCounters::HostCounters() : m_leader(-1), m_misses(-1) {}
+
+bool HostCounters::open() {
+    if (available()) {
+        return true;
+    }
+    m_leader = openCounter(PERF_COUNT_HW_CACHE_RESULT_ACCESS, -1);
+    if (m_leader < 0) {
+        return false;
+    }
+    m_misses = openCounter(PERF_COUNT_HW_CACHE_RESULT_MISS, m_leader);
+    if (m_misses < 0) {
+        close(m_leader);
+        m_leader = -1;
+        return false;
+    }
+    return true;
+}
+
+HostCounters::~HostCounters() {
+    if (available()) {
+        close(m_misses);
+        close(m_leader);
+    }
+}
+
+void HostCounters::enable() {
+    if (available()) {
+        ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+void HostCounters::disable() {
+    if (available()) {
+        ioctl(m_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+HostCounterValues HostCounters::read() const {
+    HostCounterValues v;
+    // the number of counters, then their values in the order opened
+    uint64_t buf[3];
+    if (available() && ::read(m_leader, buf, sizeof(buf)) == sizeof(buf) &&
+        buf[0] == 2) {
+        v.dtlbLoads = buf[1];
+        v.dtlbLoadMisses = buf[2];
+    }
+    return v;
+}
+}  // namespace remu
+#else
+namespace remu {
+HostCounters::HostCounters() : m_leader(-1), m_misses(-1) {}
+HostCounters::~HostCounters() {}
+bool HostCounters::open() { return false; }
+void HostCounters::enable() {}
+void HostCounters::disable() {}
+HostCounterValues HostCounters::read() const { return {}; }
+}  // namespace remu
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+
+namespace remu {
+struct HostCounterValues {
+    uint64_t dtlbLoads = 0;
+    uint64_t dtlbLoadMisses = 0;
+};
+
+// host hardware counters of the thread that runs the guest, read through
+// perf_event_open. they only count while enabled, so the debugger's own
+// work stays out. inert until opened, and where perf events are not
+// available
+class HostCounters {
+private:
+    int m_leader;  // dTLB loads, the group leader
+    int m_misses;  // dTLB load misses
+
+public:
+    HostCounters();
+    ~HostCounters();
+    HostCounters(const HostCounters&) = delete;
+    HostCounters& operator=(const HostCounters&) = delete;
+
+    // false if the host does not let us count
+    bool open();
+    bool available() const { return m_leader >= 0; }
+
+    void enable();
+    void disable();
+    HostCounterValues read() const;
+};
+}  // namespace remu
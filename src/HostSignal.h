@@ -0,0 +1,22 @@
+#pragma once
+
+#include <signal.h>
+
+namespace remu {
+// hand a signal that is not ours to the handler installed before ours
+inline void forwardSignal(const struct sigaction& old, int sig,
+                          siginfo_t* info, void* context) {
+    if ((old.sa_flags & SA_SIGINFO) != 0) {
+        old.sa_sigaction(sig, info, context);
+    } else if (old.sa_handler == SIG_DFL) {
+        // a fault repeats as soon as we return, anything else is raised
+        // again
+        sigaction(sig, &old, nullptr);
+        if (sig != SIGSEGV && sig != SIGBUS) {
+            raise(sig);
+        }
+    } else if (old.sa_handler != SIG_IGN) {
+        old.sa_handler(sig);
+    }
+}
+}  // namespace remu
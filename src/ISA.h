@@ -3,3 +3,11 @@
 #include <cstdint>
 
 using Word_t = uint32_t;
+
+template <typename T, unsigned Width>
+inline T signExtend(const T x) {
+    struct {
+        T n : Width;
+    } s = {.n = x};
+    return s.n;
+}
@@ -1,22 +1,16 @@
 #include "Instruction.h"
 
+#include <algorithm>
 #include <cstdint>
-#include <unordered_map>
+#include <iterator>
 
 #include "Memory.h"
 #include "Processor.h"
+#include "Semantics.h"
 #include "Util.h"
 
 namespace {
 
-template <typename T, unsigned Width>
-inline T signExtend(const T x) {
-    struct {
-        T n : Width;
-    } s = {.n = x};
-    return s.n;
-}
-
 inline Word_t opcode(const Word_t inst) { return inst & 0x7F; }
 
 inline Word_t rd(const Word_t inst) { return (inst >> 7) & 0x1F; }
@@ -62,296 +56,181 @@ inline Word_t pred(const Word_t inst) { return imm<27, 24>(inst); }
 
 inline Word_t succ(const Word_t inst) { return imm<23, 20>(inst); }
 
-constexpr uint32_t opcode_mask(uint32_t bits) { return bits & 0x7F; }
 constexpr uint32_t funct3_mask(uint32_t bits) { return (bits & 0x7) << 12; }
-constexpr uint32_t funct7_mask(uint32_t bits) { return (bits & 0x7F) << 25; }
 
-}  // namespace
+using remu::InstId;
+using remu::InstructionDecodeInfo;
+using remu::InstructionFormat;
+
+// decoded instructions carry the handlers of untraced runs
+using DecodePolicy = remu::Processor::Policy<false>;
+
+// the instruction spec
+constexpr InstructionDecodeInfo g_instList[] = {
+#define INST(id, name, match, mask, format)                    \
+    {name, match, mask, InstructionFormat::format, InstId::id, \
+     remu::exec##id<remu::Processor, DecodePolicy>},
+#include "Instructions.def"
+#undef INST
+};
+constexpr size_t NumInsts = std::size(g_instList);
+
+// decode key: opcode[6:2], funct3, funct7[5] and funct7[0]. every
+// instruction is looked up in the slot of its key and only has to be told
+// apart from the few that share those bits
+constexpr int DecodeKeyBits = 10;
+constexpr size_t NumKeys = 1u << DecodeKeyBits;
+constexpr size_t MaxCandidates = 4;
+
+constexpr uint32_t decodeKey(uint32_t bits) {
+    return (((bits >> 2) & 0x1F) << 5) | (((bits >> 12) & 0x7) << 2) |
+           (((bits >> 30) & 1) << 1) | ((bits >> 25) & 1);
+}
 
-namespace remu {
+// bits of the instruction word covered by decodeKey()
+constexpr uint32_t KeyBits =
+    (mask(6, 2) << 2) | funct3_mask(0x7) | (1u << 30) | (1u << 25);
+
+constexpr bool sharesKey(uint32_t key, const InstructionDecodeInfo& info) {
+    uint32_t bits = 0b11 | ((key >> 5) << 2) | funct3_mask(key >> 2) |
+                    (((key >> 1) & 1) << 30) | ((key & 1) << 25);
+    return ((bits ^ info.match) & info.mask & KeyBits) == 0;
+}
+
+constexpr size_t countCandidates() {
+    size_t n = 0;
+    for (uint32_t key = 0; key < NumKeys; ++key) {
+        for (const auto& info : g_instList) {
+            n += sharesKey(key, info);
+        }
+    }
+    return n;
+}
+
+// candidates of key k are candidates[first[k] .. first[k + 1]), in spec
+// order
+struct DecodeTable {
+    std::array<uint16_t, NumKeys + 1> first;
+    std::array<uint8_t, countCandidates()> candidates;
+};
+
+constexpr DecodeTable buildDecodeTable() {
+    DecodeTable t{};
+    size_t n = 0;
+    for (uint32_t key = 0; key < NumKeys; ++key) {
+        t.first[key] = n;
+        for (size_t i = 0; i < NumInsts; ++i) {
+            if (sharesKey(key, g_instList[i])) {
+                t.candidates[n++] = i;
+            }
+        }
+    }
+    t.first[NumKeys] = n;
+    return t;
+}
+
+constexpr DecodeTable g_decodeTable = buildDecodeTable();
 
-std::unordered_map<uint32_t, Operation> Instruction::m_instMap;
-std::vector<InstructionDecodeInfo> Instruction::m_instList{
-    // R type
-    {"add|sub|sll|slt|sltu|xor|srl|sra|or|and", opcode_mask(0b0110011),
-     InstructionFormat::IF_R,
-     [](Processor& cpu, Memory& mem, uint32_t inst) {
-         uint32_t funct = (funct7(inst) << 3) | funct3(inst);
-         switch (funct) {
-             case 0b000'0000'000:  // add
-                 cpu.reg(rd(inst)) = cpu.reg(rs1(inst)) + cpu.reg(rs2(inst));
-                 break;
-             case 0b010'0000'000:  // sub
-                 cpu.reg(rd(inst)) = cpu.reg(rs1(inst)) - cpu.reg(rs2(inst));
-                 break;
-             case 0b000'0000'001:  // sll
-                 cpu.reg(rd(inst)) = cpu.reg(rs1(inst)) << cpu.reg(rs2(inst));
-                 break;
-             case 0b000'0000'010:  // slt
-                 cpu.reg(rd(inst)) =
-                     (int32_t)cpu.reg(rs1(inst)) < (int32_t)cpu.reg(rs2(inst));
-                 break;
-             case 0b000'0000'011:  // sltu
-                 cpu.reg(rd(inst)) = cpu.reg(rs1(inst)) < cpu.reg(rs2(inst));
-                 break;
-             case 0b000'0000'100:  // xor
-                 cpu.reg(rd(inst)) = cpu.reg(rs1(inst)) ^ cpu.reg(rs2(inst));
-                 break;
-             case 0b000'0000'101:  // srl
-                 cpu.reg(rd(inst)) = cpu.reg(rs1(inst)) >> cpu.reg(rs2(inst));
-                 break;
-             case 0b010'0000'101:  // sra
-                 cpu.reg(rd(inst)) =
-                     (int32_t)cpu.reg(rs1(inst)) >> cpu.reg(rs2(inst));
-                 break;
-             case 0b000'0000'110:  // or
-                 cpu.reg(rd(inst)) = cpu.reg(rs1(inst)) | cpu.reg(rs2(inst));
-                 break;
-             case 0b000'0000'111:  // and
-                 cpu.reg(rd(inst)) = cpu.reg(rs1(inst)) & cpu.reg(rs2(inst));
-                 break;
-
-             case 0b000'0001'000:  // mul
-                 cpu.reg(rd(inst)) = cpu.reg(rs1(inst)) * cpu.reg(rs2(inst));
-                 break;
-             case 0b000'0001'001:  // mulh
-                 cpu.reg(rd(inst)) = ((int64_t)cpu.reg(rs1(inst)) *
-                                      (int64_t)cpu.reg(rs2(inst))) >>
-                                     XLEN;
-                 break;
-             case 0b000'0001'010:  // mulhsu
-                 cpu.reg(rd(inst)) = ((int64_t)cpu.reg(rs1(inst)) *
-                                      (uint64_t)cpu.reg(rs2(inst))) >>
-                                     XLEN;
-                 break;
-             case 0b000'0001'011:  // mulhu
-                 cpu.reg(rd(inst)) = ((uint64_t)cpu.reg(rs1(inst)) *
-                                      (uint64_t)cpu.reg(rs2(inst))) >>
-                                     XLEN;
-                 break;
-             case 0b000'0001'100:  // div
-                 cpu.reg(rd(inst)) =
-                     (int32_t)cpu.reg(rs1(inst)) / (int32_t)cpu.reg(rs2(inst));
-                 break;
-             case 0b000'0001'101:  // divu
-                 cpu.reg(rd(inst)) = cpu.reg(rs1(inst)) / cpu.reg(rs2(inst));
-                 break;
-             case 0b000'0001'110:  // rem
-                 cpu.reg(rd(inst)) =
-                     (int32_t)cpu.reg(rs1(inst)) % (int32_t)cpu.reg(rs2(inst));
-                 break;
-             case 0b000'0001'111:  // remu
-                 cpu.reg(rd(inst)) = cpu.reg(rs1(inst)) % cpu.reg(rs2(inst));
-                 break;
-             default:
-                 InvalidInstruction(inst, cpu.pc());
-                 break;
-         }
-     }},
-    {"lb|lh|lw|lbu|lhu", opcode_mask(0b000'0011), InstructionFormat::IF_I,
-     [](Processor& cpu, Memory& mem, uint32_t inst) {
-         Word_t addr = cpu.reg(rs1(inst)) + signExtend<int32_t, 12>(immI(inst));
-         switch (funct3(inst)) {
-             case 0b000:  // lb
-                 cpu.reg(rd(inst)) = signExtend<int32_t, 8>(
-                     mem.vMemReadWithTrace<uint8_t>(addr));
-                 break;
-             case 0b100:  // lbu
-                 cpu.reg(rd(inst)) = mem.vMemReadWithTrace<uint8_t>(addr);
-                 break;
-             case 0b001:  // lh
-                 cpu.reg(rd(inst)) = signExtend<int32_t, 16>(
-                     mem.vMemReadWithTrace<uint16_t>(addr));
-                 break;
-             case 0b101:  // lhu
-                 cpu.reg(rd(inst)) = mem.vMemReadWithTrace<uint16_t>(addr);
-                 break;
-             case 0b010:  // lw
-                 cpu.reg(rd(inst)) = signExtend<int32_t, 32>(
-                     mem.vMemReadWithTrace<uint32_t>(addr));
-                 break;
-             default:
-                 InvalidInstruction(inst, cpu.pc());
-                 break;
-         }
-     }},
-    {"sb|sh|sw", opcode_mask(0b010'0011), InstructionFormat::IF_S,
-     [](Processor& cpu, Memory& mem, uint32_t inst) {
-         Word_t addr = cpu.reg(rs1(inst)) + signExtend<int32_t, 12>(immS(inst));
-         switch (funct3(inst)) {
-             case 0b000:  // sb
-                 mem.vMemWriteWithTrace<uint8_t>(addr, cpu.reg(rs2(inst)));
-                 break;
-             case 0b001:  // sh
-                 mem.vMemWriteWithTrace<uint16_t>(addr, cpu.reg(rs2(inst)));
-                 break;
-             case 0b010:  // sw
-                 mem.vMemWriteWithTrace<uint32_t>(addr, cpu.reg(rs2(inst)));
-                 break;
-             default:
-                 InvalidInstruction(inst, cpu.pc());
-                 break;
-         }
-     }},
-    {"addi|slti|sltiu|xori|ori|andi|slli|srli|srai", opcode_mask(0b001'0011),
-     InstructionFormat::IF_I,
-     [](Processor& cpu, Memory& mem, uint32_t inst) {
-         switch (funct3(inst)) {
-             case 0b000:  // addi:         000
-                 cpu.reg(rd(inst)) =
-                     cpu.reg(rs1(inst)) + signExtend<int32_t, 12>(immI(inst));
-                 break;
-             case 0b010:  // slti:         010
-                 cpu.reg(rd(inst)) =
-                     (int32_t)cpu.reg(rs1(inst)) <
-                     (int32_t)signExtend<int32_t, 12>(immI(inst));
-                 break;
-             case 0b011:  // sltiu:        011
-                 cpu.reg(rd(inst)) =
-                     cpu.reg(rs1(inst)) < signExtend<int32_t, 12>(immI(inst));
-                 break;
-             case 0b100:  // xori:         100
-                 cpu.reg(rd(inst)) =
-                     cpu.reg(rs1(inst)) ^ signExtend<int32_t, 12>(immI(inst));
-                 break;
-             case 0b110:  // ori:          110
-                 cpu.reg(rd(inst)) =
-                     cpu.reg(rs1(inst)) | signExtend<int32_t, 12>(immI(inst));
-                 break;
-             case 0b111:  // andi:         111
-                 cpu.reg(rd(inst)) =
-                     cpu.reg(rs1(inst)) & signExtend<int32_t, 12>(immI(inst));
-                 break;
-             case 0b001:  // slli: 00'0000  001
-                 cpu.reg(rd(inst)) = cpu.reg(rs1(inst)) << shamt(inst);
-             case 0b101:
-                 // srli: 000'0000  101 shamt=rs2
-                 if (funct7(inst) == 0) {
-                     cpu.reg(rd(inst)) = cpu.reg(rs1(inst)) >> shamt(inst);
-                 } else if (funct7(inst) == 0b010'0000) {
-                     // srai: 010'0000  101
-                     cpu.reg(rd(inst)) =
-                         (int32_t)cpu.reg(rs1(inst)) >> shamt(inst);
-                 } else {
-                     InvalidInstruction(inst, cpu.pc());
-                 }
-                 break;
-             default:
-                 InvalidInstruction(inst, cpu.pc());
-                 break;
-         }
-     }},
-    {"fence|fence.i", opcode_mask(0b000'1111), InstructionFormat::IF_I,
-     [](Processor& cpu, Memory& mem, uint32_t inst) {
-         ThrowRuntimeError("unimplemented instruction");
-     }},
-    {"ecall|ebreak|csrrw|csrrs|csrrc|csrrwi|csrrsi|csrrci",
-     opcode_mask(0b111'0011), InstructionFormat::IF_I,
-     [](Processor& cpu, Memory& mem, uint32_t inst) {
-         switch (funct3(inst)) {
-             case 0b000:  // ecall ebreak
-                 switch (immI(inst)) {
-                     case 0:  // ecall
-                         break;
-                     case 1:  // ebreak
-                         break;
-                     default:
-                         InvalidInstruction(inst, cpu.pc());
-                         break;
-                 }
-                 break;
-             case 0b001:  // csrrw
-                          //  auto csr = immI(inst);
-                 break;
-             case 0b010:  // csrrs
-                 break;
-             case 0b011:  // csrrc
-                 break;
-             case 0b101:  // csrrwi
-                 break;
-             case 0b110:  // csrrsi
-                 break;
-             case 0b111:  // csrrci
-                 break;
-             default:
-                 InvalidInstruction(inst, cpu.pc());
-                 break;
-         }
-     }},
-    {"beq|bne|blt|bge|bltu|bgeu", opcode_mask(0b110'0011),
-     InstructionFormat::IF_B,
-     [](Processor& cpu, Memory& mem, uint32_t inst) {
-         switch (funct3(inst)) {
-             case 0b000:  // beq
-                 if (cpu.reg(rs1(inst)) == cpu.reg(rs2(inst))) {
-                     cpu.npc() = cpu.pc() + signExtend<int32_t, 13>(immB(inst));
-                 }
-                 break;
-             case 0b101:  // bge
-                 if ((int32_t)cpu.reg(rs1(inst)) >=
-                     (int32_t)cpu.reg(rs2(inst))) {
-                     cpu.npc() = cpu.pc() + signExtend<int32_t, 13>(immB(inst));
-                 }
-                 break;
-             case 0b111:  // bgeu
-                 if (cpu.reg(rs1(inst)) >= cpu.reg(rs2(inst))) {
-                     cpu.npc() = cpu.pc() + signExtend<int32_t, 13>(immB(inst));
-                 }
-                 break;
-             case 0b100:  // blt
-                 if ((int32_t)cpu.reg(rs1(inst)) <
-                     (int32_t)cpu.reg(rs2(inst))) {
-                     cpu.npc() = cpu.pc() + signExtend<int32_t, 13>(immB(inst));
-                 }
-                 break;
-             case 0b110:  // bltu
-                 if (cpu.reg(rs1(inst)) < cpu.reg(rs2(inst))) {
-                     cpu.npc() = cpu.pc() + signExtend<int32_t, 13>(immB(inst));
-                 }
-                 break;
-             case 0b001:  // bne
-                 if (cpu.reg(rs1(inst)) != cpu.reg(rs2(inst))) {
-                     cpu.npc() = cpu.pc() + signExtend<int32_t, 13>(immB(inst));
-                 }
-                 break;
-             default:
-                 InvalidInstruction(inst, cpu.pc());
-                 break;
-         }
-     }},
-    {"lui", opcode_mask(0b011'0111), InstructionFormat::IF_U,
-     [](Processor& cpu, Memory& mem, uint32_t inst) {
-         cpu.reg(rd(inst)) = signExtend<int32_t, 32>(immU(inst) << 12);
-     }},
-    {"auipc", opcode_mask(0b001'0111), InstructionFormat::IF_U,
-     [](Processor& cpu, Memory& mem, uint32_t inst) {
-         cpu.reg(rd(inst)) =
-             cpu.pc() + signExtend<int32_t, 32>(immU(inst) << 12);
-     }},
-    {"jal", opcode_mask(0b110'1111), InstructionFormat::IF_J,
-     [](Processor& cpu, Memory& mem, uint32_t inst) {
-         cpu.reg(rd(inst)) = cpu.pc() + 4;
-         cpu.npc() = cpu.pc() + signExtend<int32_t, 20>(immJ(inst));
-     }},
-    {"jalr", opcode_mask(0b110'0111), InstructionFormat::IF_I,
-     [](Processor& cpu, Memory& mem, uint32_t inst) {
-         Word_t t = cpu.pc() + 4;
-         cpu.npc() =
-             (cpu.reg(rs1(inst)) + signExtend<int32_t, 12>(immI(inst))) & (~1);
-         cpu.reg(rd(inst)) = t;
-     }}};
-
-void Instruction::init() {
-    for (const auto& info : m_instList) {
-        m_instMap.emplace(info.opcode, info.op);
+constexpr bool specIsWellFormed() {
+    for (const auto& info : g_instList) {
+        // 32-bit encodings only, and match may not test unmasked bits
+        if ((info.match & 0b11) != 0b11 || (info.match & ~info.mask) != 0) {
+            return false;
+        }
     }
+    return true;
 }
 
-Operation Instruction::decode() {
-    auto itor = m_instMap.find(opcode(m_bits));
-    if (itor == m_instMap.end()) [[unlikely]] {
-        InvalidInstruction(m_bits, 0);
+constexpr size_t maxCandidatesPerKey() {
+    size_t most = 0;
+    for (uint32_t key = 0; key < NumKeys; ++key) {
+        most = std::max<size_t>(
+            most, g_decodeTable.first[key + 1] - g_decodeTable.first[key]);
     }
-    return itor->second;
+    return most;
+}
+
+static_assert(NumInsts <= UINT8_MAX, "InstId does not fit the table");
+static_assert(specIsWellFormed(), "bad match/mask in Instructions.def");
+static_assert(maxCandidatesPerKey() <= MaxCandidates,
+              "too many instructions share a decode key, extend decodeKey()");
+}  // namespace
+
+namespace remu {
+DecodedInst Instruction::decode() const {
+    const InstructionDecodeInfo* found = nullptr;
+    uint32_t key = decodeKey(m_bits);
+    for (uint32_t i = g_decodeTable.first[key];
+         i < g_decodeTable.first[key + 1]; ++i) {
+        const auto& info = g_instList[g_decodeTable.candidates[i]];
+        if ((m_bits & info.mask) == info.match) {
+            found = &info;
+            break;
+        }
+    }
+    if (found == nullptr) [[unlikely]] {
+        return DecodedInst{.handler = execIllegal<Processor, DecodePolicy>,
+                           .id = InstId::Illegal,
+                           .bits = m_bits,
+                           .imm = 0,
+                           .rd = RegNum,
+                           .rs1 = 0,
+                           .rs2 = 0};
+    }
+    const InstructionDecodeInfo& info = *found;
+
+    Word_t imm = 0;
+    switch (info.type) {
+        case InstructionFormat::IF_R:
+            break;
+        case InstructionFormat::IF_I:
+            imm = signExtend<int32_t, 12>(immI(m_bits));
+            break;
+        case InstructionFormat::IF_S:
+            imm = signExtend<int32_t, 12>(immS(m_bits));
+            break;
+        case InstructionFormat::IF_B:
+            imm = signExtend<int32_t, 13>(immB(m_bits));
+            break;
+        case InstructionFormat::IF_U:
+            imm = immU(m_bits) << 12;
+            break;
+        case InstructionFormat::IF_J:
+            imm = signExtend<int32_t, 21>(immJ(m_bits));
+            break;
+    }
+
+    Word_t dst = rd(m_bits);
+    return DecodedInst{.handler = info.handler,
+                       .id = info.id,
+                       .bits = m_bits,
+                       .imm = imm,
+                       .rd = static_cast<uint8_t>(dst == 0 ? RegNum : dst),
+                       .rs1 = static_cast<uint8_t>(rs1(m_bits)),
+                       .rs2 = static_cast<uint8_t>(rs2(m_bits))};
+}
+
+const DecodedInst& fetchFaultInst() {
+    static const DecodedInst inst{
+        .handler = execFetchFault<Processor, DecodePolicy>,
+        .id = InstId::FetchFault,
+        .bits = 0,
+        .imm = 0,
+        .rd = RegNum,
+        .rs1 = 0,
+        .rs2 = 0};
+    return inst;
+}
+
+const DecodedInst& fetchPageFaultInst() {
+    static const DecodedInst inst{
+        .handler = execFetchPageFault<Processor, DecodePolicy>,
+        .id = InstId::FetchPageFault,
+        .bits = 0,
+        .imm = 0,
+        .rd = RegNum,
+        .rs1 = 0,
+        .rs2 = 0};
+    return inst;
 }
-}  // namespace remu
\ No newline at end of file
+}  // namespace remu
@@ -1,16 +1,19 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
-#include <functional>
 #include <string_view>
-#include <vector>
 
 #include "ISA.h"
 
 namespace remu {
 class Processor;
 class Memory;
-using Operation = std::function<void(Processor&, Memory&, uint32_t inst)>;
+struct DecodedInst;
+// one handler per mnemonic, dispatched through a plain function pointer.
+// returns false when the instruction trapped, npc then points at the trap
+// handler
+using Handler = bool (*)(Processor&, Memory&, const DecodedInst& inst);
 
 enum class InstructionFormat : uint8_t {
     IF_R = 0,
@@ -21,31 +24,62 @@ enum class InstructionFormat : uint8_t {
     IF_J
 };
 
+// pseudo-instructions that fetch and decode hand out instead of failing,
+// their handlers raise the fault
+#define REMU_PSEUDO_INSTS(X) \
+    X(Illegal)               \
+    X(FetchFault)            \
+    X(FetchPageFault)
+
+enum class InstId : uint8_t {
+#define INST(id, name, match, mask, format) id,
+#include "Instructions.def"
+#undef INST
+#define PSEUDO(id) id,
+    REMU_PSEUDO_INSTS(PSEUDO)
+#undef PSEUDO
+    Count
+};
+
 struct InstructionDecodeInfo {
     std::string_view name;
-    uint32_t opcode;
+    uint32_t match;  // (bits & mask) == match
+    uint32_t mask;
     InstructionFormat type;
-    Operation op;
+    InstId id;
+    Handler handler;
+};
+
+// instruction word with its operand fields already extracted, so the
+// handler does not have to re-decode the bits on every execution
+struct DecodedInst {
+    Handler handler;
+    InstId id;
+    Word_t bits;
+    Word_t imm;  // sign-extended immediate of the instruction format
+    uint8_t rd;  // x0 is redirected to the write sink, see Registers
+    uint8_t rs1;
+    uint8_t rs2;
 };
 
+// decoding is driven by Instructions.def. the decode table is generated
+// from it at compile time, see Instruction.cpp
 class Instruction {
 private:
     uint32_t m_bits;
 
-    static std::unordered_map<uint32_t, Operation> m_instMap;
-    static std::vector<InstructionDecodeInfo> m_instList;
-
 public:
     Instruction(uint32_t bits) : m_bits(bits) {}
     ~Instruction() {}
 
-    Operation decode();
+    // words that match nothing in the spec decode to InstId::Illegal
+    DecodedInst decode() const;
 
     uint32_t getBits() const { return m_bits; }
-
-    static void init();
-
-private:
-    // Word_t& reg(int i) { return m_cpu.getReg(i); }
 };
+
+// stands in for the instruction at a pc outside RAM
+const DecodedInst& fetchFaultInst();
+// stands in for the instruction at a pc the page table refuses to fetch
+const DecodedInst& fetchPageFaultInst();
 }  // namespace remu
\ No newline at end of file
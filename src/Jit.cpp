@@ -0,0 +1,640 @@
+#include "Jit.h"
+
+#include <sys/mman.h>
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+#include "BlockCache.h"
+#include "Memory.h"
+#include "Processor.h"
+#include "X86Emitter.h"
+
+#if defined(__x86_64__)
+namespace {
+using remu::Block;
+using remu::DecodedInst;
+using remu::InstId;
+using remu::JitContext;
+using remu::PageSize;
+using remu::RegNum;
+using namespace remu::x86;
+
+// host registers guest registers are allocated to, in order of preference.
+// rsi and r8-r11 are caller-saved, r12-r14 are saved by the prologue
+constexpr std::array<Reg, 8> AllocatableRegs{RSI, R8,  R9,  R10,
+                                             R11, R12, R13, R14};
+// pinned for the whole block
+constexpr Reg CtxReg = RDI;
+constexpr Reg RegsReg = RBX;
+constexpr Reg RamReg = R15;
+constexpr Reg FlagsReg = RBP;
+constexpr std::array<Reg, 6> SavedRegs{RBX, RBP, R12, R13, R14, R15};
+
+constexpr int32_t CtxRegs = offsetof(JitContext, regs);
+constexpr int32_t CtxRam = offsetof(JitContext, ram);
+constexpr int32_t CtxPageFlags = offsetof(JitContext, pageFlags);
+constexpr int32_t CtxPc = offsetof(JitContext, pc);
+constexpr int32_t CtxExecuted = offsetof(JitContext, executed);
+
+struct OperandUse {
+    bool rs1;
+    bool rs2;
+    bool rd;
+};
+
+OperandUse operandUse(InstId id) {
+    switch (id) {
+        case InstId::Lui:
+        case InstId::Auipc:
+        case InstId::Jal:
+            return {false, false, true};
+        case InstId::Sb:
+        case InstId::Sh:
+        case InstId::Sw:
+        case InstId::Beq:
+        case InstId::Bne:
+        case InstId::Blt:
+        case InstId::Bge:
+        case InstId::Bltu:
+        case InstId::Bgeu:
+            return {true, true, false};
+        case InstId::Lb:
+        case InstId::Lh:
+        case InstId::Lw:
+        case InstId::Lbu:
+        case InstId::Lhu:
+        case InstId::Addi:
+        case InstId::Slti:
+        case InstId::Sltiu:
+        case InstId::Xori:
+        case InstId::Ori:
+        case InstId::Andi:
+        case InstId::Slli:
+        case InstId::Srli:
+        case InstId::Srai:
+        case InstId::Jalr:
+            return {true, false, true};
+        default:
+            return {true, true, true};
+    }
+}
+
+class BlockCompiler {
+private:
+    enum class Result { Next, EndsBlock, Unsupported };
+
+    struct SideExit {
+        size_t fixup;
+        Word_t pc;  // ~0u: already stored by the exiting instruction
+        uint32_t executed;
+    };
+
+    Emitter& m_as;
+    const Block& m_block;
+    Word_t m_ramBase;
+    Word_t m_ramSize;
+    // host register of each guest register, RSP when it stays in memory
+    std::array<Reg, RegNum + 1> m_hostReg;
+    std::array<bool, RegNum + 1> m_written;
+    std::vector<SideExit> m_exits;
+
+public:
+    BlockCompiler(Emitter& as, const Block& b, Word_t ramBase,
+                  Word_t ramSize)
+        : m_as(as), m_block(b), m_ramBase(ramBase), m_ramSize(ramSize) {
+        m_hostReg.fill(RSP);
+        m_written.fill(false);
+    }
+
+    void compile() {
+        allocateRegisters();
+        prologue();
+
+        uint32_t i = 0;
+        Result r = Result::Next;
+        for (; i < m_block.size; ++i) {
+            r = emit(m_block.insts[i], m_block.pcs[i], i);
+            if (r != Result::Next) {
+                break;
+            }
+        }
+        if (r != Result::EndsBlock) {
+            // ran off the end of the block, or stopped in front of an
+            // instruction left to the interpreter
+            exitTo(i < m_block.size ? m_block.pcs[i] : m_block.endPc, i);
+        }
+
+        size_t epiloguePos = m_as.pos();
+        epilogue();
+        for (const auto& e : m_exits) {
+            m_as.bind(e.fixup);
+            if (e.pc != DynamicPc) {
+                m_as.storeImm(CtxReg, CtxPc, e.pc);
+            }
+            m_as.storeImm(CtxReg, CtxExecuted, e.executed);
+            m_as.bindTo(m_as.jmp(), epiloguePos);
+        }
+    }
+
+private:
+    static constexpr Word_t DynamicPc = ~0u;
+
+    // false for the last instruction, and for every control transfer in
+    // a plain block
+    bool inTrace(uint32_t i) const { return i + 1 < m_block.size; }
+
+    bool inHost(uint8_t g) const { return m_hostReg[g] != RSP; }
+
+    void allocateRegisters() {
+        std::array<uint32_t, RegNum + 1> uses{};
+        for (uint32_t i = 0; i < m_block.size; ++i) {
+            const DecodedInst& d = m_block.insts[i];
+            OperandUse use = operandUse(d.id);
+            uses[d.rs1] += use.rs1;
+            uses[d.rs2] += use.rs2;
+            if (use.rd) {
+                uses[d.rd]++;
+                m_written[d.rd] = true;
+            }
+        }
+        // x0 reads as an immediate, writes to the sink are dropped
+        uses[0] = 0;
+        uses[RegNum] = 0;
+        for (Reg host : AllocatableRegs) {
+            uint8_t best = 0;
+            for (uint8_t g = 1; g < RegNum; ++g) {
+                if (!inHost(g) && uses[g] > uses[best]) {
+                    best = g;
+                }
+            }
+            if (uses[best] == 0) {
+                break;
+            }
+            m_hostReg[best] = host;
+            uses[best] = 0;
+        }
+    }
+
+    void prologue() {
+        for (Reg r : SavedRegs) {
+            m_as.push(r);
+        }
+        m_as.load64(RegsReg, CtxReg, CtxRegs);
+        m_as.load64(RamReg, CtxReg, CtxRam);
+        m_as.load64(FlagsReg, CtxReg, CtxPageFlags);
+        for (uint8_t g = 1; g < RegNum; ++g) {
+            if (inHost(g)) {
+                m_as.load(m_hostReg[g], RegsReg, 4 * g);
+            }
+        }
+    }
+
+    void epilogue() {
+        for (uint8_t g = 1; g < RegNum; ++g) {
+            if (inHost(g) && m_written[g]) {
+                m_as.store(RegsReg, 4 * g, m_hostReg[g]);
+            }
+        }
+        for (auto it = SavedRegs.rbegin(); it != SavedRegs.rend(); ++it) {
+            m_as.pop(*it);
+        }
+        m_as.ret();
+    }
+
+    void exitTo(Word_t pc, uint32_t executed) {
+        m_as.storeImm(CtxReg, CtxPc, pc);
+        m_as.storeImm(CtxReg, CtxExecuted, executed);
+    }
+
+    void sideExit(size_t fixup, Word_t pc, uint32_t executed) {
+        m_exits.push_back({fixup, pc, executed});
+    }
+
+    void loadGuest(Reg dst, uint8_t g) {
+        if (g == 0) {
+            m_as.alu(AluOp::Xor, dst, dst);
+        } else if (inHost(g)) {
+            m_as.mov(dst, m_hostReg[g]);
+        } else {
+            m_as.load(dst, RegsReg, 4 * g);
+        }
+    }
+
+    void aluGuest(AluOp op, Reg dst, uint8_t g) {
+        if (g == 0) {
+            m_as.alu(op, dst, 0);
+        } else if (inHost(g)) {
+            m_as.alu(op, dst, m_hostReg[g]);
+        } else {
+            m_as.alu(op, dst, RegsReg, 4 * g);
+        }
+    }
+
+    void storeGuest(uint8_t g, Reg src) {
+        if (g == RegNum) {
+            return;
+        }
+        if (inHost(g)) {
+            m_as.mov(m_hostReg[g], src);
+        } else {
+            m_as.store(RegsReg, 4 * g, src);
+        }
+    }
+
+    // guest address rs1 + imm, turned into an offset into RAM in rcx.
+    // accesses outside RAM leave to the interpreter
+    void ramOffset(const DecodedInst& d, int size, Word_t pc, uint32_t i) {
+        loadGuest(RCX, d.rs1);
+        if (d.imm != 0) {
+            m_as.alu(AluOp::Add, RCX, static_cast<int32_t>(d.imm));
+        }
+        m_as.alu(AluOp::Sub, RCX, static_cast<int32_t>(m_ramBase));
+        m_as.alu(AluOp::Cmp, RCX, static_cast<int32_t>(m_ramSize - size));
+        sideExit(m_as.jcc(CondA), pc, i);
+    }
+
+    Result emitBranch(Cond taken, const DecodedInst& d, Word_t pc,
+                      uint32_t i) {
+        if ((d.imm & 3) != 0) {
+            // a taken branch to a misaligned target traps
+            return Result::Unsupported;
+        }
+        loadGuest(RAX, d.rs1);
+        aluGuest(AluOp::Cmp, RAX, d.rs2);
+        if (!inTrace(i)) {
+            sideExit(m_as.jcc(taken), pc + d.imm, i + 1);
+            exitTo(pc + 4, i + 1);
+            return Result::EndsBlock;
+        }
+        // inside a trace, leave when the branch goes the other way than
+        // it did while the trace was recorded
+        if (m_block.pcs[i + 1] == pc + d.imm) {
+            sideExit(m_as.jcc(static_cast<Cond>(taken ^ 1)), pc + 4, i + 1);
+        } else {
+            sideExit(m_as.jcc(taken), pc + d.imm, i + 1);
+        }
+        return Result::Next;
+    }
+
+    void emitRegReg(AluOp op, const DecodedInst& d) {
+        loadGuest(RAX, d.rs1);
+        aluGuest(op, RAX, d.rs2);
+        storeGuest(d.rd, RAX);
+    }
+
+    void emitRegImm(AluOp op, const DecodedInst& d) {
+        loadGuest(RAX, d.rs1);
+        m_as.alu(op, RAX, static_cast<int32_t>(d.imm));
+        storeGuest(d.rd, RAX);
+    }
+
+    void emitShift(ShiftOp op, const DecodedInst& d, bool imm) {
+        loadGuest(RAX, d.rs1);
+        if (imm) {
+            m_as.shift(op, RAX, d.imm & 0x1F);
+        } else {
+            loadGuest(RCX, d.rs2);
+            m_as.shiftCl(op, RAX);
+        }
+        storeGuest(d.rd, RAX);
+    }
+
+    void emitSet(Cond c, const DecodedInst& d, bool imm) {
+        loadGuest(RAX, d.rs1);
+        if (imm) {
+            m_as.alu(AluOp::Cmp, RAX, static_cast<int32_t>(d.imm));
+        } else {
+            aluGuest(AluOp::Cmp, RAX, d.rs2);
+        }
+        m_as.setcc(c, RAX);
+        storeGuest(d.rd, RAX);
+    }
+
+    // upper half of the 64-bit product, operands sign- or zero-extended
+    void emitMulHigh(const DecodedInst& d, bool signed1, bool signed2) {
+        loadGuest(RAX, d.rs1);
+        loadGuest(RCX, d.rs2);
+        if (signed1) {
+            m_as.movsxd(RAX, RAX);
+        }
+        if (signed2) {
+            m_as.movsxd(RCX, RCX);
+        }
+        m_as.imul64(RAX, RCX);
+        m_as.shift64(signed1 ? ShiftOp::Sar : ShiftOp::Shr, RAX, 32);
+        storeGuest(d.rd, RAX);
+    }
+
+    // x86 faults on division by zero and on INT_MIN / -1, RISC-V defines
+    // a result for both
+    void emitDiv(const DecodedInst& d, bool isSigned, bool remainder) {
+        loadGuest(RAX, d.rs1);
+        loadGuest(RCX, d.rs2);
+        m_as.test(RCX, RCX);
+        size_t byZero = m_as.jcc(CondE);
+        size_t byMinusOne = 0;
+        if (isSigned) {
+            m_as.alu(AluOp::Cmp, RCX, -1);
+            size_t notMinusOne = m_as.jcc(CondNE);
+            // x / -1 = -x (INT_MIN stays INT_MIN), x % -1 = 0
+            if (remainder) {
+                m_as.alu(AluOp::Xor, RAX, RAX);
+            } else {
+                m_as.neg(RAX);
+            }
+            byMinusOne = m_as.jmp();
+            m_as.bind(notMinusOne);
+            m_as.cdq();
+            m_as.idiv(RCX);
+        } else {
+            m_as.alu(AluOp::Xor, RDX, RDX);
+            m_as.div(RCX);
+        }
+        if (remainder) {
+            m_as.mov(RAX, RDX);
+        }
+        size_t done = m_as.jmp();
+        m_as.bind(byZero);
+        // x / 0 = all ones, x % 0 = x
+        if (!remainder) {
+            m_as.movImm(RAX, ~0u);
+        }
+        m_as.bind(done);
+        if (isSigned) {
+            m_as.bind(byMinusOne);
+        }
+        storeGuest(d.rd, RAX);
+    }
+
+    enum class Ext { Zero, Sign };
+
+    void emitLoad(const DecodedInst& d, int size, Ext ext, Word_t pc,
+                  uint32_t i) {
+        ramOffset(d, size, pc, i);
+        switch (size) {
+            case 1:
+                ext == Ext::Sign ? m_as.loadS8(RAX, RamReg, RCX)
+                                 : m_as.loadU8(RAX, RamReg, RCX);
+                break;
+            case 2:
+                ext == Ext::Sign ? m_as.loadS16(RAX, RamReg, RCX)
+                                 : m_as.loadU16(RAX, RamReg, RCX);
+                break;
+            default:
+                m_as.load32(RAX, RamReg, RCX);
+                break;
+        }
+        storeGuest(d.rd, RAX);
+    }
+
+    // stores also leave when they cross a page or hit a page holding code,
+    // watched by a write tracer or clean since the checkpoint, the
+    // interpreter then invalidates the code, calls the tracers or records
+    // the dirty page
+    void emitStore(const DecodedInst& d, int size, Word_t pc, uint32_t i) {
+        ramOffset(d, size, pc, i);
+        if (size > 1) {
+            m_as.mov(RDX, RCX);
+            m_as.alu(AluOp::And, RDX, PageSize - 1);
+            m_as.alu(AluOp::Cmp, RDX, PageSize - size);
+            sideExit(m_as.jcc(CondA), pc, i);
+        }
+        m_as.mov(RDX, RCX);
+        m_as.shift(ShiftOp::Shr, RDX, remu::PageShift);
+        m_as.testByte(FlagsReg, RDX,
+                      remu::PageCode | remu::PageWriteTraced |
+                          remu::PageClean);
+        sideExit(m_as.jcc(CondNE), pc, i);
+
+        loadGuest(RAX, d.rs2);
+        switch (size) {
+            case 1:
+                m_as.store8(RamReg, RCX, RAX);
+                break;
+            case 2:
+                m_as.store16(RamReg, RCX, RAX);
+                break;
+            default:
+                m_as.store32(RamReg, RCX, RAX);
+                break;
+        }
+    }
+
+    Result emit(const DecodedInst& d, Word_t pc, uint32_t i) {
+        switch (d.id) {
+            case InstId::Add:
+                emitRegReg(AluOp::Add, d);
+                break;
+            case InstId::Sub:
+                emitRegReg(AluOp::Sub, d);
+                break;
+            case InstId::Xor:
+                emitRegReg(AluOp::Xor, d);
+                break;
+            case InstId::Or:
+                emitRegReg(AluOp::Or, d);
+                break;
+            case InstId::And:
+                emitRegReg(AluOp::And, d);
+                break;
+            case InstId::Sll:
+                emitShift(ShiftOp::Shl, d, false);
+                break;
+            case InstId::Srl:
+                emitShift(ShiftOp::Shr, d, false);
+                break;
+            case InstId::Sra:
+                emitShift(ShiftOp::Sar, d, false);
+                break;
+            case InstId::Slt:
+                emitSet(CondL, d, false);
+                break;
+            case InstId::Sltu:
+                emitSet(CondB, d, false);
+                break;
+
+            case InstId::Mul:
+                loadGuest(RAX, d.rs1);
+                loadGuest(RCX, d.rs2);
+                m_as.imul(RAX, RCX);
+                storeGuest(d.rd, RAX);
+                break;
+            case InstId::Mulh:
+                emitMulHigh(d, true, true);
+                break;
+            case InstId::Mulhsu:
+                emitMulHigh(d, true, false);
+                break;
+            case InstId::Mulhu:
+                emitMulHigh(d, false, false);
+                break;
+            case InstId::Div:
+                emitDiv(d, true, false);
+                break;
+            case InstId::Divu:
+                emitDiv(d, false, false);
+                break;
+            case InstId::Rem:
+                emitDiv(d, true, true);
+                break;
+            case InstId::Remu:
+                emitDiv(d, false, true);
+                break;
+
+            case InstId::Lb:
+                emitLoad(d, 1, Ext::Sign, pc, i);
+                break;
+            case InstId::Lh:
+                emitLoad(d, 2, Ext::Sign, pc, i);
+                break;
+            case InstId::Lw:
+                emitLoad(d, 4, Ext::Zero, pc, i);
+                break;
+            case InstId::Lbu:
+                emitLoad(d, 1, Ext::Zero, pc, i);
+                break;
+            case InstId::Lhu:
+                emitLoad(d, 2, Ext::Zero, pc, i);
+                break;
+            case InstId::Sb:
+                emitStore(d, 1, pc, i);
+                break;
+            case InstId::Sh:
+                emitStore(d, 2, pc, i);
+                break;
+            case InstId::Sw:
+                emitStore(d, 4, pc, i);
+                break;
+
+            case InstId::Addi:
+                emitRegImm(AluOp::Add, d);
+                break;
+            case InstId::Xori:
+                emitRegImm(AluOp::Xor, d);
+                break;
+            case InstId::Ori:
+                emitRegImm(AluOp::Or, d);
+                break;
+            case InstId::Andi:
+                emitRegImm(AluOp::And, d);
+                break;
+            case InstId::Slti:
+                emitSet(CondL, d, true);
+                break;
+            case InstId::Sltiu:
+                emitSet(CondB, d, true);
+                break;
+            case InstId::Slli:
+                emitShift(ShiftOp::Shl, d, true);
+                break;
+            case InstId::Srli:
+                emitShift(ShiftOp::Shr, d, true);
+                break;
+            case InstId::Srai:
+                emitShift(ShiftOp::Sar, d, true);
+                break;
+
+            case InstId::Lui:
+                m_as.movImm(RAX, d.imm);
+                storeGuest(d.rd, RAX);
+                break;
+            case InstId::Auipc:
+                m_as.movImm(RAX, pc + d.imm);
+                storeGuest(d.rd, RAX);
+                break;
+            case InstId::Fence:
+                break;
+
+            case InstId::Beq:
+                return emitBranch(CondE, d, pc, i);
+            case InstId::Bne:
+                return emitBranch(CondNE, d, pc, i);
+            case InstId::Blt:
+                return emitBranch(CondL, d, pc, i);
+            case InstId::Bge:
+                return emitBranch(CondGE, d, pc, i);
+            case InstId::Bltu:
+                return emitBranch(CondB, d, pc, i);
+            case InstId::Bgeu:
+                return emitBranch(CondAE, d, pc, i);
+            case InstId::Jal:
+                if ((d.imm & 3) != 0) {
+                    return Result::Unsupported;
+                }
+                m_as.movImm(RAX, pc + 4);
+                storeGuest(d.rd, RAX);
+                if (inTrace(i)) {
+                    // the trace continues at the target
+                    break;
+                }
+                exitTo(pc + d.imm, i + 1);
+                return Result::EndsBlock;
+            case InstId::Jalr:
+                loadGuest(RAX, d.rs1);
+                m_as.alu(AluOp::Add, RAX, static_cast<int32_t>(d.imm));
+                m_as.alu(AluOp::And, RAX, ~1);
+                // a misaligned target traps, the interpreter redoes the
+                // jalr and raises it
+                m_as.mov(RCX, RAX);
+                m_as.alu(AluOp::And, RCX, 3);
+                sideExit(m_as.jcc(CondNE), pc, i);
+                m_as.movImm(RCX, pc + 4);
+                storeGuest(d.rd, RCX);
+                m_as.store(CtxReg, CtxPc, RAX);
+                if (inTrace(i)) {
+                    m_as.alu(AluOp::Cmp, RAX,
+                             static_cast<int32_t>(m_block.pcs[i + 1]));
+                    sideExit(m_as.jcc(CondNE), DynamicPc, i + 1);
+                    break;
+                }
+                m_as.storeImm(CtxReg, CtxExecuted, i + 1);
+                return Result::EndsBlock;
+
+            default:
+                // fence.i, ecall, ebreak, mret, csr access and the
+                // faulting pseudo-instructions
+                return Result::Unsupported;
+        }
+        return Result::Next;
+    }
+};
+}  // namespace
+
+namespace remu {
+Jit::Jit(Word_t ramBase, Word_t ramSize)
+    : m_code(nullptr), m_used(0), m_ramBase(ramBase), m_ramSize(ramSize) {
+    void* p = mmap(nullptr, CodeBufferSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED) {
+        m_code = static_cast<uint8_t*>(p);
+    }
+}
+
+Jit::~Jit() {
+    if (m_code != nullptr) {
+        munmap(m_code, CodeBufferSize);
+    }
+}
+
+bool Jit::compile(Block* b) {
+    Emitter as(m_code + m_used, CodeBufferSize - m_used);
+    BlockCompiler(as, *b, m_ramBase, m_ramSize).compile();
+    if (as.full()) {
+        return false;
+    }
+    b->native = reinterpret_cast<NativeCode>(m_code + m_used);
+    // keep entry points 16-byte aligned
+    m_used = (m_used + as.pos() + 15) & ~size_t(15);
+    return true;
+}
+}  // namespace remu
+#else
+namespace remu {
+Jit::Jit(Word_t ramBase, Word_t ramSize)
+    : m_code(nullptr), m_used(0), m_ramBase(ramBase), m_ramSize(ramSize) {}
+Jit::~Jit() {}
+bool Jit::compile(Block* b) { return false; }
+}  // namespace remu
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ISA.h"
+
+namespace remu {
+struct Block;
+class Memory;
+
+// state shared between the executor and translated code
+struct JitContext {
+    Word_t* regs;              // Registers::x
+    uint8_t* ram;              // host address of the start of guest RAM
+    const uint8_t* pageFlags;  // Memory page flags, indexed from there
+    Word_t pc;                 // out: pc to continue at
+    uint32_t executed;         // out: instructions completed natively
+};
+
+using NativeCode = void (*)(JitContext*);
+
+// translates hot blocks and traces to x86-64. guest registers used in a
+// block are kept in host registers for the whole block; loads and stores
+// go straight to guest RAM. anything else (system instructions, accesses
+// outside RAM, across a page or to a page with code on it) leaves the
+// translated code, and the executor interprets the rest of the block.
+// branches inside a trace become guards that leave it.
+class Jit {
+private:
+    static constexpr size_t CodeBufferSize = 32u << 20;
+
+    uint8_t* m_code;
+    size_t m_used;
+    // guest RAM, built into the range checks of loads and stores
+    Word_t m_ramBase;
+    Word_t m_ramSize;
+
+public:
+    Jit(Word_t ramBase, Word_t ramSize);
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // true if native translation is available on this host
+    bool enabled() const { return m_code != nullptr; }
+
+    // translate b and store the result in b->native. returns false when
+    // the code buffer is full, the caller then drops all translated blocks
+    // and calls reset()
+    bool compile(Block* b);
+    void reset() { m_used = 0; }
+};
+}  // namespace remu
@@ -1,4 +1,66 @@
 #include "Machine.h"
 
+#include <unistd.h>
+
+#include <cstdio>
+#include <iostream>
+
 namespace remu {
-};  // namespace remu
\ No newline at end of file
+Snapshot::~Snapshot() {
+    if (ramFd >= 0) {
+        close(ramFd);
+    }
+}
+
+Machine::Machine(const Snapshot& s)
+    : m_mem(s.memBase, s.memSize, s.ramFd),
+      m_cpu(m_mem),
+      m_debugger(m_cpu, m_mem) {
+    if (!m_mem.getBus().addDevices(s.devices)) {
+        ThrowRuntimeError("cannot map the devices of a snapshot");
+    }
+    m_cpu.restoreState(s.hart);
+}
+
+std::shared_ptr<const Snapshot> Machine::snapshot() {
+    auto s = std::make_shared<Snapshot>();
+    s->memBase = m_mem.getBase();
+    s->memSize = m_mem.getSize();
+    s->ramFd = m_mem.freeze();
+    s->hart = m_cpu.saveState();
+    s->devices = m_mem.getBus().copyDevices();
+    return s;
+}
+
+std::unique_ptr<Machine> Machine::clone() {
+    return std::make_unique<Machine>(*snapshot());
+}
+
+void Machine::checkpoint() {
+    m_mem.checkpoint();
+    m_checkpointHart = m_cpu.saveState();
+    m_checkpointDevices = m_mem.getBus().copyDevices();
+}
+
+bool Machine::resetToCheckpoint() {
+    if (!m_checkpointHart || !m_mem.resetToCheckpoint()) {
+        return false;
+    }
+    m_cpu.restoreState(*m_checkpointHart);
+    m_mem.getBus().restoreDevices(m_checkpointDevices);
+    return true;
+}
+
+void Machine::start() {
+    try {
+        m_cpu.execute(UINT64_MAX);
+    } catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+    }
+    if (m_cpu.getState() == REMUState::ABORT) {
+        const Registers& r = m_cpu.csrs();
+        std::printf("abort: mcause = %u, mepc = 0x%08x, mtval = 0x%08x\n",
+                    r.mcause, r.mepc, r.mtval);
+    }
+}
+}  // namespace remu
@@ -1,8 +1,70 @@
 #pragma once
 
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "Bus.h"
 #include "ISA.h"
 #include "Memory.h"
 #include "Processor.h"
+#include "debug/Debugger.h"
 
 namespace remu {
-};  // namespace remu
\ No newline at end of file
+// a machine frozen at one point, which any number of clones start from.
+// RAM is a memfd that nothing writes any more, and every clone maps it
+// privately, so they share its pages until they write them
+struct Snapshot {
+    Word_t memBase;
+    Word_t memSize;
+    int ramFd;
+    HartState hart;
+    std::vector<Region> devices;  // ROM and MMIO, see Bus::copyDevices
+
+    Snapshot() : ramFd(-1) {}
+    ~Snapshot();
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+};
+
+class Machine {
+private:
+    Memory m_mem;
+    Processor m_cpu;
+    Debugger m_debugger;
+
+    // what resetToCheckpoint() goes back to besides RAM
+    std::optional<HartState> m_checkpointHart;
+    std::vector<Region> m_checkpointDevices;
+
+public:
+    Machine(Word_t memBase, Word_t memSize)
+        : m_mem(memBase, memSize), m_cpu(m_mem), m_debugger(m_cpu, m_mem) {}
+    // a clone of the machine s was taken from, as it was then
+    explicit Machine(const Snapshot& s);
+    ~Machine() {}
+
+    Memory& getMemory() { return m_mem; }
+    Processor& getProcessor() { return m_cpu; }
+    Debugger& getDebugger() { return m_debugger; }
+
+    // the first snapshot of a machine is free, later ones copy the RAM
+    // pages that are not all zeros. start as many machines from one as
+    // needed rather than taking one each. ends the checkpoint
+    std::shared_ptr<const Snapshot> snapshot();
+    // a machine that goes on from here on its own
+    std::unique_ptr<Machine> clone();
+
+    // for runs from the same point in one machine. the reset restores
+    // the hart, the devices and the RAM pages written since, and keeps
+    // the caches and translated code that are still valid
+    void checkpoint();
+    bool resetToCheckpoint();
+
+    void start();
+
+    void debug() { m_debugger.start(); }
+
+    void stop() {}
+};
+}  // namespace remu
@@ -1,8 +1,482 @@
 #include "Memory.h"
 
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+
+namespace {
+// Sv32 page table entry bits
+constexpr Word_t PteV = 1u << 0;
+constexpr Word_t PteR = 1u << 1;
+constexpr Word_t PteW = 1u << 2;
+constexpr Word_t PteX = 1u << 3;
+constexpr Word_t PteU = 1u << 4;
+constexpr Word_t PteA = 1u << 6;
+constexpr Word_t PteD = 1u << 7;
+constexpr int PtePpnShift = 10;
+constexpr int VpnBits = 10;
+
+// whether a leaf pte lets an access of type through, made in U-mode if
+// user is set
+bool pteAllows(Word_t pte, remu::AccessType type, bool user,
+               const remu::Translation &t) {
+    if ((pte & PteU) != 0) {
+        // S-mode never runs U pages, and only touches them with SUM
+        if (!user && (type == remu::AccessType::Fetch || !t.sum)) {
+            return false;
+        }
+    } else if (user) {
+        return false;
+    }
+    switch (type) {
+        case remu::AccessType::Read:
+            return (pte & PteR) != 0 || (t.mxr && (pte & PteX) != 0);
+        case remu::AccessType::Write:
+            return (pte & PteW) != 0;
+        case remu::AccessType::Fetch:
+        default:
+            return (pte & PteX) != 0;
+    }
+}
+
+// map size bytes at a HugePageSize aligned address, so that a huge page
+// can back every aligned 2 MiB of it. the slack around is given back
+uint8_t *mapAligned(uint64_t size, int prot) {
+    uint64_t slack = remu::HugePageSize;
+    void *p = mmap(nullptr, size + slack, prot,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+    auto *raw = static_cast<uint8_t *>(p);
+    auto *aligned = reinterpret_cast<uint8_t *>(
+        (reinterpret_cast<uintptr_t>(raw) + slack - 1) & ~(slack - 1));
+    if (aligned != raw) {
+        munmap(raw, aligned - raw);
+    }
+    munmap(aligned + size, raw + slack - aligned);
+    return aligned;
+}
+
+// an empty memfd of size bytes, -1 on failure. its pages are only
+// allocated once written
+int createRamFile(uint64_t size) {
+    int fd = memfd_create("remu-ram", MFD_CLOEXEC);
+    if (fd >= 0 && ftruncate(fd, size) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// map fd over the RAM reservation at host, shared or copy-on-write
+bool mapRamFile(uint8_t *host, uint64_t size, int fd, bool shared) {
+    void *p = mmap(host, size, PROT_READ | PROT_WRITE,
+                   (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED |
+                       MAP_NORESERVE,
+                   fd, 0);
+    return p != MAP_FAILED;
+}
+
+// whether the host backs shmem with transparent huge pages when asked.
+// the mode in effect is the one in brackets
+bool shmemHugePages() {
+    std::FILE *f = std::fopen(
+        "/sys/kernel/mm/transparent_hugepage/shmem_enabled", "r");
+    if (f == nullptr) {
+        return false;
+    }
+    char modes[128] = {};
+    size_t n = std::fread(modes, 1, sizeof(modes) - 1, f);
+    std::fclose(f);
+    modes[n] = '\0';
+    const char *mode = std::strchr(modes, '[');
+    return mode != nullptr && std::strncmp(mode, "[never]", 7) != 0 &&
+           std::strncmp(mode, "[deny]", 6) != 0;
+}
+
+bool isZeroPage(const uint8_t *page) {
+    static const uint8_t zeros[remu::PageSize] = {};
+    return std::memcmp(page, zeros, remu::PageSize) == 0;
+}
+}  // namespace
+
+#if REMU_GUARD_REGION
+#include "HostSignal.h"
+
+namespace {
+thread_local remu::GuestFault *t_guestFault;
+struct sigaction g_oldSegv;
+
+void onGuestFault(int sig, siginfo_t *info, void *context) {
+    remu::GuestFault *f = t_guestFault;
+    auto *addr = static_cast<const uint8_t *>(info->si_addr);
+    if (f == nullptr || addr < f->space ||
+        addr >= f->space + remu::GuestSpaceSize) {
+        remu::forwardSignal(g_oldSegv, sig, info, context);
+        return;
+    }
+    siglongjmp(f->env, 1);
+}
+
+void installGuestFaultHandler() {
+    static bool installed = false;
+    if (installed) {
+        return;
+    }
+    // left by siglongjmp, SIGSEGV must not stay blocked
+    struct sigaction sa {};
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_sigaction = onGuestFault;
+    sigaction(SIGSEGV, &sa, &g_oldSegv);
+    installed = true;
+}
+}  // namespace
+#endif
+
 namespace remu {
+uint8_t *Memory::mapRam(int imageFd) {
+    if (m_size == 0 || ((m_base | m_size) & (PageSize - 1)) != 0 ||
+        uint64_t{m_base} + m_size > (1ull << 32)) {
+        ThrowRuntimeError("bad RAM placement");
+    }
+    int fd = imageFd;
+    if (fd < 0) {
+        m_ramFd = createRamFile(m_size);
+        if (m_ramFd < 0) {
+            ThrowRuntimeError("cannot create guest RAM");
+        }
+        fd = m_ramFd;
+    }
+#if REMU_GUARD_REGION
+    // the whole guest space, with only RAM accessible
+    m_space = mapAligned(GuestSpaceSize, PROT_NONE);
+    if (m_space == nullptr) {
+        ThrowRuntimeError("cannot reserve the guest address space");
+    }
+    uint8_t *ram = m_space + m_base;
+    installGuestFaultHandler();
+#else
+    uint8_t *ram = mapAligned(m_size, PROT_NONE);
+    if (ram == nullptr) {
+        ThrowRuntimeError("cannot reserve guest RAM");
+    }
+#endif
+    if (!mapRamFile(ram, m_size, fd, imageFd < 0)) {
+        ThrowRuntimeError("cannot map guest RAM");
+    }
+    return ram;
+}
+
+int Memory::freeze() {
+    if (m_checkpointFd >= 0) {
+        // the mapping about to go is the one resets fall back on
+        close(m_checkpointFd);
+        m_checkpointFd = -1;
+        m_dirtyPages.clear();
+        for (uint8_t &f : m_pageFlags) {
+            f &= ~PageClean;
+        }
+    }
+    int image = m_ramFd;
+    if (image < 0) {
+        // RAM went its own way from the image it was mapped from, so its
+        // contents go to a new one. pages of zeros stay holes
+        image = createRamFile(m_size);
+        if (image < 0) {
+            ThrowRuntimeError("cannot create a RAM image");
+        }
+        for (Word_t offset = 0; offset < m_size; offset += PageSize) {
+            const uint8_t *page = m_phyMem + offset;
+            if (!isZeroPage(page) &&
+                pwrite(image, page, PageSize, offset) != PageSize) {
+                close(image);
+                ThrowRuntimeError("cannot write a RAM image");
+            }
+        }
+    }
+    if (!mapRamFile(m_phyMem, m_size, image, false)) {
+        if (image != m_ramFd) {
+            close(image);
+        }
+        ThrowRuntimeError("cannot map guest RAM");
+    }
+    m_ramFd = -1;
+    m_anonRam = false;
+    // the new mapping came without the advice and the write protection
+    if (m_hugePages) {
+        setHugePages(true);
+    }
+    m_guard.reprotect();
+    return image;
+}
+
+void Memory::closeRamFiles() {
+    for (int fd : {m_ramFd, m_checkpointFd}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+void Memory::checkpoint() {
+    int image = freeze();
+    m_checkpointFd = image;
+    for (Word_t page = 0; page < m_size >> PageShift; ++page) {
+        m_pageFlags[page] |= PageClean;
+    }
+}
+
+bool Memory::resetToCheckpoint() {
+    if (m_checkpointFd < 0) {
+        return false;
+    }
+    // runs of adjacent pages go back in one call
+    std::sort(m_dirtyPages.begin(), m_dirtyPages.end());
+    for (size_t i = 0; i < m_dirtyPages.size();) {
+        size_t j = i + 1;
+        while (j < m_dirtyPages.size() &&
+               m_dirtyPages[j] == m_dirtyPages[j - 1] + 1) {
+            ++j;
+        }
+        madvise(m_phyMem + (m_dirtyPages[i] << PageShift),
+                (j - i) << PageShift, MADV_DONTNEED);
+        i = j;
+    }
+    for (Word_t page : m_dirtyPages) {
+        m_pageFlags[page] |= PageClean;
+        if (m_pageFlags[page] & PageCode) {
+            m_codeWriteHandler(m_base + (page << PageShift), PageSize);
+        }
+    }
+    m_dirtyPages.clear();
+    // page tables may have changed back under the TLB
+    flushTlb();
+    return true;
+}
+
+void Memory::noteWrite(Word_t vaddr, Word_t numOfBytes) {
+    Word_t first = (vaddr - m_base) >> PageShift;
+    Word_t last = (vaddr - m_base + numOfBytes - 1) >> PageShift;
+    uint8_t flags = 0;
+    for (Word_t page = first; page <= last; ++page) {
+        flags |= m_pageFlags[page];
+        if (m_pageFlags[page] & PageClean) {
+            m_pageFlags[page] &= ~PageClean;
+            m_dirtyPages.push_back(page);
+        }
+    }
+    if (flags & PageCode) {
+        m_codeWriteHandler(vaddr, numOfBytes);
+    }
+}
+
+#if REMU_GUARD_REGION
+void Memory::unmapRam() {
+    munmap(m_space, GuestSpaceSize);
+    closeRamFiles();
+}
+
+void Memory::armGuestFault(GuestFault *f) {
+    if (f != nullptr) {
+        f->space = m_space;
+    }
+    t_guestFault = f;
+}
+#else
+void Memory::unmapRam() {
+    munmap(m_phyMem, m_size);
+    closeRamFiles();
+}
+#endif
+
+bool Memory::moveRamToAnonymous() {
+    if (m_ramFd < 0) {
+        return false;
+    }
+    uint8_t *ram = mapAligned(m_size, PROT_READ | PROT_WRITE);
+    if (ram == nullptr) {
+        return false;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(ram, m_size, MADV_HUGEPAGE);
+#endif
+    // only what was written is copied, holes stay untouched
+    for (off_t data = lseek(m_ramFd, 0, SEEK_DATA); data >= 0;) {
+        off_t hole = lseek(m_ramFd, data, SEEK_HOLE);
+        if (hole < 0) {
+            hole = m_size;
+        }
+        std::memcpy(ram + data, m_phyMem + data, hole - data);
+        data = lseek(m_ramFd, hole, SEEK_DATA);
+    }
+    if (mremap(ram, m_size, m_size, MREMAP_MAYMOVE | MREMAP_FIXED,
+               m_phyMem) == MAP_FAILED) {
+        munmap(ram, m_size);
+        return false;
+    }
+    close(m_ramFd);
+    m_ramFd = -1;
+    m_anonRam = true;
+    // the new mapping came without the write protection
+    m_guard.reprotect();
+    return true;
+}
+
+bool Memory::setHugePages(bool on) {
+#ifdef MADV_HUGEPAGE
+    // the advice is taken on shmem only if the host allows it, which it
+    // does not by default
+    if (on && !m_anonRam && !shmemHugePages() && !moveRamToAnonymous()) {
+        return false;
+    }
+    if (madvise(m_phyMem, m_size, on ? MADV_HUGEPAGE : MADV_NOHUGEPAGE) !=
+        0) {
+        return false;
+    }
+    m_hugePages = on;
+    return true;
+#else
+    return false;
+#endif
+}
+
+Access Memory::fillTlb(Word_t vaddr, AccessType type) {
+    const Translation &t = m_xlate;
+    bool user = type == AccessType::Fetch ? t.fetchUser : t.dataUser;
+    uint64_t table = t.root;
+    Word_t pteAddr;
+    Word_t pte;
+    int level = 1;
+    for (;; --level) {
+        Word_t vpn = (vaddr >> (PageShift + VpnBits * level)) &
+                     ((1u << VpnBits) - 1);
+        uint64_t addr = table + 4 * vpn;
+        if (addr >= (1ull << 32) || !isValidAccess(addr, 4)) {
+            return Access::Fault;
+        }
+        pteAddr = addr;
+        pte = *hostPtr<Word_t>(pteAddr);
+        if ((pte & PteV) == 0 || ((pte & PteR) == 0 && (pte & PteW) != 0)) {
+            return Access::PageFault;
+        }
+        if ((pte & (PteR | PteX)) != 0) {
+            break;
+        }
+        if (level == 0) {
+            return Access::PageFault;
+        }
+        table = uint64_t{pte >> PtePpnShift} << PageShift;
+    }
+
+    uint64_t ppn = pte >> PtePpnShift;
+    // a megapage must be aligned to its size
+    if (level == 1 && (ppn & ((1u << VpnBits) - 1)) != 0) {
+        return Access::PageFault;
+    }
+    if (!pteAllows(pte, type, user, t)) {
+        return Access::PageFault;
+    }
+    uint64_t paddr = ppn << PageShift;
+    if (level == 1) {
+        paddr |= vaddr & (((1u << VpnBits) - 1) << PageShift);
+    }
+    // pages outside RAM may be ROM or devices. their entries get no tags,
+    // so every access to them comes back to the slow path
+    bool ram = paddr < (1ull << 32) && isValidAccess(paddr, PageSize);
+    if (!ram && (paddr >= (1ull << 32) || m_bus.find(paddr) == nullptr)) {
+        return Access::Fault;
+    }
+
+    // A and D are kept up to date here instead of faulting
+    Word_t updated = pte | PteA | (type == AccessType::Write ? PteD : 0);
+    if (updated != pte) {
+        store<Word_t>(pteAddr, updated);
+        pte = updated;
+    }
+
+    // a write only hits once D is set, so the first one comes back here
+    Word_t page = ram ? vaddr & ~(PageSize - 1) : NoTlbTag;
+    TlbEntry &e = tlbEntryOf(vaddr);
+    e.readTag = pteAllows(pte, AccessType::Read, t.dataUser, t) ? page
+                                                                 : NoTlbTag;
+    e.writeTag = (pte & PteD) != 0 &&
+                         pteAllows(pte, AccessType::Write, t.dataUser, t)
+                     ? page
+                     : NoTlbTag;
+    e.fetchTag = pteAllows(pte, AccessType::Fetch, t.fetchUser, t)
+                     ? page
+                     : NoTlbTag;
+    e.paddr = paddr;
+    e.host = ram ? hostPtr<uint8_t>(paddr) : nullptr;
+    return Access::Ok;
+}
+
+Access Memory::translate(Word_t vaddr, AccessType type, Word_t &paddr) {
+    TlbEntry &e = tlbEntryOf(vaddr);
+    Word_t tag = type == AccessType::Read    ? e.readTag
+                 : type == AccessType::Write ? e.writeTag
+                                             : e.fetchTag;
+    if (tag != (vaddr & ~(PageSize - 1))) {
+        Access a = fillTlb(vaddr, type);
+        if (a != Access::Ok) {
+            return a;
+        }
+    }
+    paddr = e.paddr + (vaddr & (PageSize - 1));
+    return Access::Ok;
+}
+
+Access Memory::fetch(Word_t pc, Word_t &bits) {
+    Word_t paddr = pc;
+    if (m_xlate.fetch) {
+        Access a = translate(pc, AccessType::Fetch, paddr);
+        if (a != Access::Ok) {
+            return a;
+        }
+    }
+    if (!isValidAccess(paddr, 4)) {
+        return m_bus.fetch(paddr, bits) ? Access::Ok : Access::Fault;
+    }
+    bits = vMemFetch(paddr);
+    return Access::Ok;
+}
+
+void Memory::observeFetchSlow(Word_t pc) {
+    Word_t paddr = pc;
+    if (m_xlate.fetch &&
+        translate(pc, AccessType::Fetch, paddr) != Access::Ok) {
+        return;
+    }
+    m_observer->fetch(paddr);
+}
+
+void Memory::setTranslation(const Translation &t) {
+    m_xlate = t;
+    m_directFetchSpan = t.fetch ? 0 : m_size - 3;
+    // entries depend on everything but which accesses are translated
+    Translation filledFor = t;
+    filledFor.fetch = false;
+    filledFor.data = false;
+    if ((t.fetch || t.data) && filledFor != m_tlbFilledFor) {
+        flushTlb();
+        m_tlbFilledFor = filledFor;
+    }
+}
+
+void Memory::flushTlb() {
+    for (TlbEntry &e : m_tlb) {
+        e.readTag = NoTlbTag;
+        e.writeTag = NoTlbTag;
+        e.fetchTag = NoTlbTag;
+    }
+}
+
 void Memory::traceMemRead(Word_t vaddr, Word_t data, int numOfBytes) {
-    for (auto t : m_memReadTraceList) {
+    for (auto &t : m_memReadTraceList) {
         if (!t.inSpan(vaddr)) {
             continue;
         }
@@ -11,11 +485,30 @@ void Memory::traceMemRead(Word_t vaddr, Word_t data, int numOfBytes) {
 }
 
 void Memory::traceMemWrite(Word_t vaddr, Word_t data, int numOfbytes) {
-    for (auto t : m_memWriteTraceList) {
+    for (auto &t : m_memWriteTraceList) {
         if (!t.inSpan(vaddr)) {
             continue;
         }
         t(vaddr, data, numOfbytes);
     }
 }
+
+void Memory::markTracedPages(const std::list<MemTracer> &list, uint8_t flag) {
+    for (auto &f : m_pageFlags) {
+        f &= ~flag;
+    }
+    for (const auto &t : list) {
+        MemSpan span = t.getSpan();
+        // only the part of the span inside RAM can ever be accessed
+        Word_t first = std::max(span.first, m_base);
+        Word_t last = std::min(span.second, m_base + (m_size - 1));
+        if (first > last) {
+            continue;
+        }
+        for (Word_t page = (first - m_base) >> PageShift;
+             page <= (last - m_base) >> PageShift; ++page) {
+            m_pageFlags[page] |= flag;
+        }
+    }
+}
 }  // namespace remu
\ No newline at end of file
@@ -1,18 +1,92 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <cstring>
 #include <functional>
 #include <list>
+#include <vector>
 
+#include "Bus.h"
 #include "ISA.h"
+#include "PageGuard.h"
 #include "Util.h"
 
+// the whole 32-bit guest address space is reserved on the host, with only
+// RAM accessible, so guest loads and stores need no bounds check. an
+// access outside RAM faults on the host and comes back as a GuestFault,
+// and the executor retries it checked
+#if defined(__x86_64__) && defined(__linux__)
+#define REMU_GUARD_REGION 1
+#include <setjmp.h>
+#else
+#define REMU_GUARD_REGION 0
+#endif
+
 namespace remu {
-constexpr Word_t MemBase = 0x80000000;
-constexpr Word_t MemSize = 1ull << 27;
+// RAM is placed at run time, these are the defaults
+constexpr Word_t DefaultMemBase = 0x80000000;
+constexpr Word_t DefaultMemSize = 1u << 27;
+// host huge page, RAM is mapped aligned to it
+constexpr uint64_t HugePageSize = 1u << 21;
+
+constexpr bool HasGuardRegion = REMU_GUARD_REGION;
+// 4 GiB, plus a page for accesses that straddle the top of it
+constexpr uint64_t GuestSpaceSize = (1ull << 32) + PageSize;
+
+#if REMU_GUARD_REGION
+// where guest execution resumes after a load or store outside RAM. the
+// executor arms one around guest execution, see Memory::armGuestFault
+struct GuestFault {
+    sigjmp_buf env;
+    const uint8_t *space;  // host address of guest address 0
+};
+#endif
+
+// per-page attributes kept by Memory
+enum PageFlag : uint8_t {
+    PageCode = 1 << 0,         // translated code lives here, see BlockCache
+    PageReadTraced = 1 << 1,   // a read tracer's span covers this page
+    PageWriteTraced = 1 << 2,  // a write tracer's span covers this page
+    PageClean = 1 << 3,        // unwritten since the checkpoint
+};
 
 using MemSpan = std::pair<Word_t, Word_t>;
 
+// compile-time policy of guest loads and stores. checked accesses test
+// the RAM bounds themselves instead of relying on the guard region, and
+// only traced ones look for tracers. executors instantiate their handlers
+// once per policy they may run under and pick one when they start, so
+// runs without tracers carry no tracing code
+template <bool IsChecked, bool IsTraced>
+struct AccessPolicy {
+    static constexpr bool Checked = IsChecked;
+    static constexpr bool Traced = IsTraced;
+};
+
+// outcome of a guest access
+enum class Access : uint8_t {
+    Ok,
+    Fault,      // nothing behind the (physical) address takes it
+    PageFault,  // Sv32 translation refused it
+};
+
+enum class AccessType : uint8_t { Read, Write, Fetch };
+
+// Sv32 translation applied to guest accesses. the hart derives it from
+// satp, its privilege mode and mstatus, see Memory::setTranslation
+struct Translation {
+    bool fetch = false;      // instruction fetches are translated
+    bool data = false;       // loads and stores are translated
+    uint64_t root = 0;       // physical address of the root page table
+    bool fetchUser = false;  // fetches are made in U-mode
+    bool dataUser = false;   // loads and stores are made in U-mode
+    bool sum = false;        // S-mode may access U pages
+    bool mxr = false;        // executable pages are readable
+
+    bool operator==(const Translation &) const = default;
+};
+
 class MemTracer {
     using MemTraceFunc =
         std::function<void(Word_t vaddr, Word_t data, int numOfBytes)>;
@@ -30,6 +104,7 @@ public:
     ~MemTracer() = default;
 
     int getId() const { return m_id; }
+    MemSpan getSpan() const { return m_span; }
 
     bool inSpan(Word_t vaddr) {
         return vaddr >= m_span.first && vaddr <= m_span.second;
@@ -42,32 +117,331 @@ public:
     bool operator==(const MemTracer *t) const { return m_id == t->m_id; }
 };
 
+// sees the fetches, loads and stores of traced runs, by physical
+// address, once each has succeeded. loads and stores outside RAM are not
+// shown. cache models are fed through it, see Cache.h
+class AccessObserver {
+public:
+    virtual ~AccessObserver() = default;
+    virtual void fetch(Word_t paddr) = 0;
+    virtual void read(Word_t paddr, int numOfBytes) = 0;
+    virtual void write(Word_t paddr, int numOfBytes) = 0;
+};
+
 class Memory {
 private:
-    uint8_t *m_phyMem;
+    Word_t m_base;  // guest address of RAM
+    Word_t m_size;
+    // memfd RAM is shared from, -1 once RAM is a private mapping of an
+    // image, see freeze()
+    int m_ramFd;
+    uint8_t *m_phyMem;  // host address of m_base
+    bool m_hugePages;
+    bool m_anonRam;  // RAM left its memfd for huge pages, see setHugePages()
+#if REMU_GUARD_REGION
+    uint8_t *m_space;  // host address of guest address 0
+#endif
+    std::vector<uint8_t> m_pageFlags;
+
+    // image of RAM at the last checkpoint, -1 without one, and the pages
+    // written since, each recorded by the store that cleared its
+    // PageClean
+    int m_checkpointFd;
+    std::vector<Word_t> m_dirtyPages;
 
     std::list<MemTracer> m_memReadTraceList;
     std::list<MemTracer> m_memWriteTraceList;
+    AccessObserver *m_observer;
+
+    // called when a store hits a page flagged PageCode
+    std::function<void(Word_t vaddr, int numOfBytes)> m_codeWriteHandler;
+
+    PageGuard m_guard;
+    // RAM and everything else mapped beside it
+    Bus m_bus;
+
+    // software TLB in front of the Sv32 page table walk. an entry holds
+    // the host address of a guest page and one tag per access type, set
+    // to the virtual page when the page allows that access under the
+    // translation it was filled for, so a hit is an index, a compare and
+    // a host access
+    struct TlbEntry {
+        Word_t readTag;
+        Word_t writeTag;
+        Word_t fetchTag;
+        Word_t paddr;  // guest physical page
+        uint8_t *host;
+    };
+    static constexpr int TlbBits = 8;
+    static constexpr Word_t NoTlbTag = ~0u;  // never page aligned
+
+    Translation m_xlate;
+    Translation m_tlbFilledFor;
+    // pc - m_base below this may be fetched directly. 0 while fetches are
+    // translated, so the fetch fast path needs no test of its own
+    Word_t m_directFetchSpan;
+    std::array<TlbEntry, 1u << TlbBits> m_tlb;
 
 private:
     void traceMemRead(Word_t vaddr, Word_t data, int numOfBytes);
     void traceMemWrite(Word_t vaddr, Word_t data, int numOfbytes);
+    [[gnu::noinline]] void observeFetchSlow(Word_t pc);
+    // recompute which pages carry flag from the spans in list
+    void markTracedPages(const std::list<MemTracer> &list, uint8_t flag);
+
+    uint8_t pageFlagsOf(Word_t vaddr) const {
+        return m_pageFlags[(vaddr - m_base) >> PageShift];
+    }
+
+    // RAM is a memfd mapped without reserving swap, so pages the guest
+    // never touches take no host memory. with imageFd it is a private
+    // copy-on-write mapping of that image instead
+    uint8_t *mapRam(int imageFd);
+    void unmapRam();
+    void closeRamFiles();
+    // move RAM shared from its memfd to anonymous memory in place, with
+    // its contents, false if it is not shared from one
+    bool moveRamToAnonymous();
+
+    // host address of a guest address. with the guard region every 32-bit
+    // address has one, otherwise only those in RAM do
+    template <typename T>
+    T *hostPtr(Word_t vaddr) const {
+#if REMU_GUARD_REGION
+        return (T *)(m_space + vaddr);
+#else
+        return (T *)(m_phyMem + (vaddr - m_base));
+#endif
+    }
+
+    TlbEntry &tlbEntryOf(Word_t vaddr) {
+        return m_tlb[(vaddr >> PageShift) & ((1u << TlbBits) - 1)];
+    }
+    // the tag an access of numOfBytes at vaddr hits. it is that of the
+    // last byte's page, so an access that straddles into the next page
+    // never matches the entry of the first one
+    static Word_t tlbTagOf(Word_t vaddr, Word_t numOfBytes) {
+        return (vaddr + numOfBytes - 1) & ~(PageSize - 1);
+    }
+    // walk the page table for vaddr and refill its TLB entry
+    Access fillTlb(Word_t vaddr, AccessType type);
+    // physical address of vaddr for an access of type, Ok if the TLB has
+    // it or the walk allows it
+    Access translate(Word_t vaddr, AccessType type, Word_t &paddr);
+
+    static bool straddles(Word_t vaddr, Word_t numOfBytes) {
+        return (vaddr & (PageSize - 1)) > PageSize - numOfBytes;
+    }
+
+    // accesses outside RAM, handed to the bus
+    template <typename T>
+    [[gnu::noinline]] Access busRead(Word_t paddr, T &data) {
+        Word_t word;
+        if (!m_bus.read(paddr, sizeof(T), word)) {
+            return Access::Fault;
+        }
+        data = static_cast<T>(word);
+        return Access::Ok;
+    }
+    template <typename T>
+    [[gnu::noinline]] Access busWrite(Word_t paddr, T data) {
+        return m_bus.write(paddr, sizeof(T), data) ? Access::Ok
+                                                   : Access::Fault;
+    }
+
+    // TLB misses, accesses to pages outside RAM, which never hit, and
+    // accesses that straddle two pages, which are made bytewise
+    template <typename T>
+    [[gnu::noinline]] Access pagedReadSlow(Word_t vaddr, T &data) {
+        if (!straddles(vaddr, sizeof(T))) {
+            Word_t paddr;
+            Access a = translate(vaddr, AccessType::Read, paddr);
+            if (a != Access::Ok) {
+                return a;
+            }
+            return isValidAccess(paddr, sizeof(T)) ? pagedRead(vaddr, data)
+                                                   : busRead(paddr, data);
+        }
+        Word_t paddrs[sizeof(T)];
+        uint8_t bytes[sizeof(T)];
+        for (Word_t i = 0; i < sizeof(T); ++i) {
+            Access a = translate(vaddr + i, AccessType::Read, paddrs[i]);
+            if (a == Access::Ok && !isValidAddr(paddrs[i])) {
+                a = busRead(paddrs[i], bytes[i]);
+            } else if (a == Access::Ok) {
+                bytes[i] = *hostPtr<uint8_t>(paddrs[i]);
+            }
+            if (a != Access::Ok) {
+                return a;
+            }
+        }
+        std::memcpy(&data, bytes, sizeof(T));
+        if (isValidAddr(paddrs[0]) && m_observer != nullptr) {
+            m_observer->read(paddrs[0], sizeof(T));
+        }
+        if (isValidAddr(paddrs[0]) &&
+            (pageFlagsOf(paddrs[0]) & PageReadTraced)) {
+            traceMemRead(paddrs[0], data, sizeof(T));
+        }
+        return Access::Ok;
+    }
+
+    template <typename T>
+    [[gnu::noinline]] Access pagedWriteSlow(Word_t vaddr, T data) {
+        if (!straddles(vaddr, sizeof(T))) {
+            Word_t paddr;
+            Access a = translate(vaddr, AccessType::Write, paddr);
+            if (a != Access::Ok) {
+                return a;
+            }
+            return isValidAccess(paddr, sizeof(T)) ? pagedWrite(vaddr, data)
+                                                   : busWrite(paddr, data);
+        }
+        // every page must allow the write before any byte is written
+        Word_t paddrs[sizeof(T)];
+        for (Word_t i = 0; i < sizeof(T); ++i) {
+            Access a = translate(vaddr + i, AccessType::Write, paddrs[i]);
+            if (a != Access::Ok) {
+                return a;
+            }
+        }
+        uint8_t bytes[sizeof(T)];
+        std::memcpy(bytes, &data, sizeof(T));
+        for (Word_t i = 0; i < sizeof(T); ++i) {
+            if (!isValidAddr(paddrs[i])) {
+                if (busWrite(paddrs[i], bytes[i]) != Access::Ok) {
+                    return Access::Fault;
+                }
+                continue;
+            }
+            store<uint8_t>(paddrs[i], bytes[i]);
+        }
+        if (isValidAddr(paddrs[0]) && m_observer != nullptr) {
+            m_observer->write(paddrs[0], sizeof(T));
+        }
+        if (isValidAddr(paddrs[0]) &&
+            (pageFlagsOf(paddrs[0]) & PageWriteTraced)) {
+            traceMemWrite(paddrs[0], data, sizeof(T));
+        }
+        return Access::Ok;
+    }
+
+    // the slow paths look for tracers whatever the policy, they are off
+    // the fast path anyway
+    template <typename T, bool Traced = true>
+    Access pagedRead(Word_t vaddr, T &data) {
+        TlbEntry &e = tlbEntryOf(vaddr);
+        if (e.readTag != tlbTagOf(vaddr, sizeof(T))) [[unlikely]] {
+            return pagedReadSlow(vaddr, data);
+        }
+        Word_t offset = vaddr & (PageSize - 1);
+        data = *(T *)(e.host + offset);
+        if (Traced && m_observer != nullptr) [[unlikely]] {
+            m_observer->read(e.paddr + offset, sizeof(T));
+        }
+        if (Traced && (pageFlagsOf(e.paddr) & PageReadTraced)) [[unlikely]] {
+            traceMemRead(e.paddr + offset, data, sizeof(T));
+        }
+        return Access::Ok;
+    }
+
+    template <typename T, bool Traced = true>
+    Access pagedWrite(Word_t vaddr, T data) {
+        TlbEntry &e = tlbEntryOf(vaddr);
+        if (e.writeTag != tlbTagOf(vaddr, sizeof(T))) [[unlikely]] {
+            return pagedWriteSlow(vaddr, data);
+        }
+        Word_t offset = vaddr & (PageSize - 1);
+        store<T>(e.paddr + offset, data);
+        if (Traced && m_observer != nullptr) [[unlikely]] {
+            m_observer->write(e.paddr + offset, sizeof(T));
+        }
+        if (Traced && (pageFlagsOf(e.paddr) & PageWriteTraced)) [[unlikely]] {
+            traceMemWrite(e.paddr + offset, data, sizeof(T));
+        }
+        return Access::Ok;
+    }
+
+    // a store hit a page holding code or one still clean
+    [[gnu::noinline]] void noteWrite(Word_t vaddr, Word_t numOfBytes);
+
+    template <typename T>
+    void store(Word_t vaddr, T data) {
+        *hostPtr<T>(vaddr) = data;
+        // a misaligned store may spill into the next page
+        uint8_t flags = m_pageFlags[(vaddr - m_base) >> PageShift] |
+                        m_pageFlags[(vaddr - m_base + sizeof(T) - 1) >>
+                                    PageShift];
+        if (flags & (PageCode | PageClean)) [[unlikely]] {
+            noteWrite(vaddr, sizeof(T));
+        }
+    }
 
 public:
-    Memory() {
-        m_phyMem = static_cast<uint8_t *>(std::aligned_alloc(4096, MemSize));
+    // base and size must be page aligned and RAM must fit the 32-bit
+    // guest space. RAM starts zeroed, or as the contents of imageFd, an
+    // image from freeze() of the same size. one spare page flag for stores
+    // that spill past the end of RAM
+    Memory(Word_t base = DefaultMemBase, Word_t size = DefaultMemSize,
+           int imageFd = -1)
+        : m_base(base),
+          m_size(size),
+          m_ramFd(-1),
+          m_phyMem(mapRam(imageFd)),
+          m_hugePages(false),
+          m_anonRam(false),
+          m_pageFlags((size >> PageShift) + 1, 0),
+          m_checkpointFd(-1),
+          m_observer(nullptr),
+          m_guard(m_phyMem, base, size),
+          m_directFetchSpan(size - 3) {
+        m_bus.addRam(base, size, m_phyMem);
+        flushTlb();
     }
     ~Memory() {
-        if (m_phyMem != nullptr) {
-            std::free(m_phyMem);
-        }
+        m_guard.clear();
+        unmapRam();
     }
 
+    Word_t getBase() const { return m_base; }
+    Word_t getSize() const { return m_size; }
+
+    // ROM and devices are added here, before the guest runs. RAM is
+    // already in place
+    Bus &getBus() { return m_bus; }
+
+    // ask the host to back RAM with transparent huge pages, which cuts
+    // host TLB misses of guests that roam over much of it. takes effect
+    // for pages touched afterwards, false if the host does not support it.
+    // hosts seldom give shmem huge pages, so RAM still shared from its
+    // memfd moves to anonymous memory, and the next freeze() copies it
+    bool setHugePages(bool on);
+
+    // a memfd holding RAM as it is now, which nothing writes from then on.
+    // RAM becomes a private mapping of it, at the same host address, so
+    // the image costs no copy unless RAM already was one. the caller owns
+    // the fd, mappings of it outlive closing it. ends the checkpoint
+    int freeze();
+
+    // remember RAM as it is now. stores from then on record the pages
+    // they dirty, the first store to a page taking the slow path once
+    void checkpoint();
+    // put the pages written since the checkpoint back as they were. each
+    // one drops its private copy and reads the image again, so the cost
+    // is in the pages written, not in the size of RAM. false without a
+    // checkpoint
+    bool resetToCheckpoint();
+    size_t dirtyPageCount() const { return m_dirtyPages.size(); }
+
+    // tracers are indexed by the pages their span covers, so accesses to
+    // any other page only pay for the page flag test
     void addMemReadTracer(const MemTracer &t) {
         m_memReadTraceList.push_back(t);
+        markTracedPages(m_memReadTraceList, PageReadTraced);
     }
     void addMemWriteTracer(const MemTracer &t) {
         m_memWriteTraceList.push_back(t);
+        markTracedPages(m_memWriteTraceList, PageWriteTraced);
     }
     void removeMemReadTracer(int id) {
         auto itor =
@@ -75,6 +449,7 @@ public:
                          [id](const MemTracer &t) { return t.getId() == id; });
         if (itor != m_memReadTraceList.end()) {
             m_memReadTraceList.erase(itor);
+            markTracedPages(m_memReadTraceList, PageReadTraced);
         }
     }
     void removeMemWriteTracer(int id) {
@@ -83,42 +458,150 @@ public:
                          [id](const MemTracer &t) { return t.getId() == id; });
         if (itor != m_memWriteTraceList.end()) {
             m_memWriteTraceList.erase(itor);
+            markTracedPages(m_memWriteTraceList, PageWriteTraced);
+        }
+    }
+
+    // one observer at a time, nullptr detaches it. the caller keeps it
+    // alive while attached
+    void setObserver(AccessObserver *o) { m_observer = o; }
+    AccessObserver *observer() const { return m_observer; }
+    // executors of traced runs report each instruction fetched at pc
+    void observeFetch(Word_t pc) {
+        if (m_observer != nullptr) [[unlikely]] {
+            observeFetchSlow(pc);
         }
     }
 
+    // write watch on span backed by host page protection, costs nothing
+    // until it is hit. false where the host cannot do this, the caller
+    // falls back to a write tracer
+    bool addWriteWatch(int id, MemSpan span) {
+        return m_guard.watch(id, span.first, span.second);
+    }
+    void removeWriteWatch(int id) { m_guard.unwatch(id); }
+    std::vector<WatchHit> takeWatchHits() { return m_guard.takeHits(); }
+
+    void setPageFlag(Word_t vaddr, uint8_t flag) {
+        m_pageFlags[(vaddr - m_base) >> PageShift] |= flag;
+    }
+    void clearPageFlag(Word_t vaddr, uint8_t flag) {
+        m_pageFlags[(vaddr - m_base) >> PageShift] &= ~flag;
+    }
+    void setCodeWriteHandler(
+        std::function<void(Word_t vaddr, int numOfBytes)> handler) {
+        m_codeWriteHandler = std::move(handler);
+    }
+
     template <typename T>
     T vMemRead(Word_t vaddr) {
         Assert(isValidAddr(vaddr));
-        T *p = (T *)(m_phyMem + vaddr - MemBase);
+        T *p = (T *)(m_phyMem + vaddr - m_base);
         return *p;
     }
 
     template <typename T>
     void vMemWrite(Word_t vaddr, T data) {
         Assert(isValidAddr(vaddr));
-        *(T *)(m_phyMem + vaddr - MemBase) = data;
+        store<T>(vaddr, data);
     }
 
-    template <typename T>
-    T vMemReadWithTrace(Word_t vaddr) {
-        T data = vMemRead<T>(vaddr);
-        traceMemRead(vaddr, data, sizeof(T));
-        return data;
+    // instruction fetch, the caller has checked isValidAccess()
+    Word_t vMemFetch(Word_t vaddr) const {
+        return *(const Word_t *)(m_phyMem + vaddr - m_base);
     }
 
-    template <typename T>
-    void vMemWriteWithTrace(Word_t vaddr, T data) {
-        vMemWrite<T>(vaddr, data);
-        traceMemWrite(vaddr, data, sizeof(T));
+    // guest loads and stores under Policy. checked, an access not entirely
+    // inside RAM goes to the bus, and returns Fault if the bus does not
+    // take it either. unchecked, they rely on the guard region and always
+    // succeed or fault on the host, which only callers that armed a
+    // GuestFault may do. translated accesses go through the TLB and are
+    // always checked. untraced, they must not run while tracers or an
+    // observer are attached, see hasTracers()
+    template <typename T, typename Policy>
+    Access vMemReadWithTrace(Word_t vaddr, T &data) {
+        if (m_xlate.data) [[unlikely]] {
+            return pagedRead<T, Policy::Traced>(vaddr, data);
+        }
+        if (Policy::Checked && !isValidAccess(vaddr, sizeof(T)))
+            [[unlikely]] {
+            return busRead(vaddr, data);
+        }
+        data = *hostPtr<T>(vaddr);
+        if (Policy::Traced && m_observer != nullptr) [[unlikely]] {
+            m_observer->read(vaddr, sizeof(T));
+        }
+        if (Policy::Traced && (pageFlagsOf(vaddr) & PageReadTraced))
+            [[unlikely]] {
+            traceMemRead(vaddr, data, sizeof(T));
+        }
+        return Access::Ok;
+    }
+
+    template <typename T, typename Policy>
+    Access vMemWriteWithTrace(Word_t vaddr, T data) {
+        if (m_xlate.data) [[unlikely]] {
+            return pagedWrite<T, Policy::Traced>(vaddr, data);
+        }
+        if (Policy::Checked && !isValidAccess(vaddr, sizeof(T)))
+            [[unlikely]] {
+            return busWrite(vaddr, data);
+        }
+        store<T>(vaddr, data);
+        if (Policy::Traced && m_observer != nullptr) [[unlikely]] {
+            m_observer->write(vaddr, sizeof(T));
+        }
+        if (Policy::Traced && (pageFlagsOf(vaddr) & PageWriteTraced))
+            [[unlikely]] {
+            traceMemWrite(vaddr, data, sizeof(T));
+        }
+        return Access::Ok;
+    }
+
+    // the word at pc for an instruction fetch, translated if fetches are
+    Access fetch(Word_t pc, Word_t &bits);
+
+    // fetches at pc may skip translation and read RAM directly. false
+    // whenever fetches are translated
+    bool isDirectFetch(Word_t pc) const {
+        return pc - m_base < m_directFetchSpan;
+    }
+
+    // Sv32. the TLB keeps what it holds while translation is off, and is
+    // flushed when the translation it was filled for changes
+    void setTranslation(const Translation &t);
+    const Translation &translation() const { return m_xlate; }
+    // sfence.vma
+    void flushTlb();
+
+#if REMU_GUARD_REGION
+    // route faults of guest accesses made on this thread to f, nullptr
+    // stops it
+    void armGuestFault(GuestFault *f);
+#endif
+
+    // raw views for translated code, which accesses RAM directly
+    uint8_t *hostBase() { return m_phyMem; }
+    const uint8_t *pageFlags() const { return m_pageFlags.data(); }
+    bool hasReadTracers() const { return !m_memReadTraceList.empty(); }
+    // runs have to be traced, for tracers or the observer
+    bool hasTracers() const {
+        return hasReadTracers() || !m_memWriteTraceList.empty() ||
+               m_observer != nullptr;
     }
 
     bool isValidAddr(Word_t vaddr) const {
-        return vaddr >= MemBase && vaddr < (MemBase + MemSize);
+        return vaddr - m_base < m_size;
+    }
+
+    // [vaddr, vaddr + numOfBytes) lies in RAM
+    bool isValidAccess(Word_t vaddr, Word_t numOfBytes) const {
+        return vaddr - m_base <= m_size - numOfBytes;
     }
 
     bool isValidMemSpan(MemSpan span) const {
-        return span.first <= span.second && span.first >= MemBase &&
-               span.second < (MemBase + MemSize);
+        return span.first <= span.second && isValidAddr(span.first) &&
+               isValidAddr(span.second);
     }
 };
 }  // namespace remu
\ No newline at end of file
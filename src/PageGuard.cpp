@@ -0,0 +1,210 @@
+#include "PageGuard.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "Memory.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "HostSignal.h"
+
+namespace {
+using remu::PageGuard;
+
+constexpr int MaxGuards = 16;
+constexpr greg_t TrapFlag = 0x100;  // EFLAGS.TF
+
+// guards with active watches, looked at by the signal handlers. they are
+// only changed between guest accesses, on the thread that runs the guest
+PageGuard* g_guards[MaxGuards];
+PageGuard* g_stepping;
+struct sigaction g_oldSegv;
+struct sigaction g_oldTrap;
+
+void onSegv(int sig, siginfo_t* info, void* context) {
+    auto* uc = static_cast<ucontext_t*>(context);
+    auto* addr = static_cast<uint8_t*>(info->si_addr);
+    for (PageGuard* g : g_guards) {
+        if (g != nullptr && g->beginStep(addr)) {
+            // run the faulting instruction, then trap into onTrap
+            g_stepping = g;
+            uc->uc_mcontext.gregs[REG_EFL] |= TrapFlag;
+            return;
+        }
+    }
+    remu::forwardSignal(g_oldSegv, sig, info, context);
+}
+
+void onTrap(int sig, siginfo_t* info, void* context) {
+    auto* uc = static_cast<ucontext_t*>(context);
+    if (g_stepping == nullptr) {
+        remu::forwardSignal(g_oldTrap, sig, info, context);
+        return;
+    }
+    g_stepping->endStep();
+    g_stepping = nullptr;
+    uc->uc_mcontext.gregs[REG_EFL] &= ~TrapFlag;
+}
+
+void installHandlers() {
+    static bool installed = false;
+    if (installed) {
+        return;
+    }
+    // the guest fault handler may be reached from ours and leaves by
+    // siglongjmp, so SIGSEGV must not stay blocked
+    struct sigaction sa {};
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_sigaction = onSegv;
+    sigaction(SIGSEGV, &sa, &g_oldSegv);
+    sa.sa_sigaction = onTrap;
+    sigaction(SIGTRAP, &sa, &g_oldTrap);
+    installed = true;
+}
+
+void registerGuard(PageGuard* g, bool active) {
+    PageGuard** slot = std::find(g_guards, g_guards + MaxGuards, g);
+    if (active && slot == g_guards + MaxGuards) {
+        slot = std::find(g_guards, g_guards + MaxGuards, nullptr);
+        if (slot != g_guards + MaxGuards) {
+            *slot = g;
+        }
+    } else if (!active && slot != g_guards + MaxGuards) {
+        *slot = nullptr;
+    }
+}
+
+bool hasSlotFor(PageGuard* g) {
+    return std::find(g_guards, g_guards + MaxGuards, g) !=
+               g_guards + MaxGuards ||
+           std::find(g_guards, g_guards + MaxGuards, nullptr) !=
+               g_guards + MaxGuards;
+}
+}  // namespace
+
+namespace remu {
+bool PageGuard::supported() { return sysconf(_SC_PAGESIZE) == PageSize; }
+
+void PageGuard::protect(bool on) {
+    for (const Watch& w : m_watches) {
+        Word_t firstPage = (w.first - m_base) >> PageShift;
+        Word_t lastPage = (w.last - m_base) >> PageShift;
+        for (Word_t page = firstPage; page <= lastPage; ++page) {
+            mprotect(m_host + (page << PageShift), PageSize,
+                     on ? PROT_READ : PROT_READ | PROT_WRITE);
+        }
+    }
+}
+
+bool PageGuard::beginStep(uint8_t* addr) {
+    if (addr < m_host || addr >= m_host + m_size ||
+        m_numStepPages == MaxStepPages) {
+        return false;
+    }
+    uint8_t* page = m_host + ((addr - m_host) & ~(PageSize - 1));
+    if (m_numStepPages == 0) {
+        m_stepVaddr = m_base + (addr - m_host);
+    }
+    m_stepPages[m_numStepPages++] = page;
+    mprotect(page, PageSize, PROT_READ | PROT_WRITE);
+    return true;
+}
+
+void PageGuard::endStep() {
+    for (int i = 0; i < m_numStepPages; ++i) {
+        mprotect(m_stepPages[i], PageSize, PROT_READ);
+    }
+    m_numStepPages = 0;
+
+    Word_t data = 0;
+    Word_t offset = m_stepVaddr - m_base;
+    std::memcpy(&data, m_host + offset,
+                std::min<Word_t>(sizeof(data), m_size - offset));
+    for (const Watch& w : m_watches) {
+        if (m_stepVaddr < w.first || m_stepVaddr > w.last) {
+            continue;
+        }
+        if (m_numHits == MaxHits) {
+            ++m_droppedHits;
+            continue;
+        }
+        m_hits[m_numHits++] = {w.id, m_stepVaddr, data};
+    }
+}
+
+bool PageGuard::watch(int id, Word_t first, Word_t last) {
+    if (!supported() || first > last || first < m_base ||
+        last - m_base >= m_size || !hasSlotFor(this)) {
+        return false;
+    }
+    installHandlers();
+    m_watches.push_back({id, first, last});
+    registerGuard(this, true);
+    protect(true);
+    return true;
+}
+
+void PageGuard::unwatch(int id) {
+    auto itor = std::find_if(m_watches.begin(), m_watches.end(),
+                             [id](const Watch& w) { return w.id == id; });
+    if (itor == m_watches.end()) {
+        return;
+    }
+    // pages may be shared with other watches, so lift all and put the
+    // remaining ones back
+    protect(false);
+    m_watches.erase(itor);
+    protect(true);
+    registerGuard(this, !m_watches.empty());
+}
+
+void PageGuard::clear() {
+    protect(false);
+    m_watches.clear();
+    registerGuard(this, false);
+}
+}  // namespace remu
+#else
+namespace remu {
+bool PageGuard::supported() { return false; }
+
+bool PageGuard::watch(int id, Word_t first, Word_t last) { return false; }
+
+void PageGuard::unwatch(int id) {}
+
+void PageGuard::clear() {}
+
+bool PageGuard::beginStep(uint8_t* addr) { return false; }
+
+void PageGuard::endStep() {}
+
+void PageGuard::protect(bool on) {}
+}  // namespace remu
+#endif
+
+namespace remu {
+PageGuard::PageGuard(uint8_t* host, Word_t base, Word_t size)
+    : m_host(host),
+      m_base(base),
+      m_size(size),
+      m_numHits(0),
+      m_droppedHits(0),
+      m_numStepPages(0),
+      m_stepVaddr(0) {}
+
+PageGuard::~PageGuard() { clear(); }
+
+std::vector<WatchHit> PageGuard::takeHits() {
+    // see what the signal handlers wrote
+    std::atomic_signal_fence(std::memory_order_acquire);
+    std::vector<WatchHit> hits(m_hits, m_hits + m_numHits);
+    m_numHits = 0;
+    return hits;
+}
+}  // namespace remu
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ISA.h"
+
+namespace remu {
+// a write that hit a guarded watch, data is the word at vaddr after it
+struct WatchHit {
+    int id;
+    Word_t vaddr;
+    Word_t data;
+};
+
+// write watchpoints backed by host page protection. the host pages behind
+// a watched guest range are mapped read-only, so a write to them faults.
+// the fault handler lets the write through by single-stepping the host
+// instruction and records it if it hit a watched span. accesses to every
+// other page run untraced, in the interpreter and in translated code.
+// only available on x86-64 Linux with 4 KiB host pages.
+class PageGuard {
+private:
+    struct Watch {
+        int id;
+        Word_t first;  // guest span, inclusive
+        Word_t last;
+    };
+
+    static constexpr int MaxHits = 256;
+    static constexpr int MaxStepPages = 2;  // a write may straddle pages
+
+    uint8_t* m_host;  // host address of guest address m_base
+    Word_t m_base;
+    Word_t m_size;
+    std::vector<Watch> m_watches;
+
+    // filled in by the signal handlers, drained by takeHits()
+    WatchHit m_hits[MaxHits];
+    int m_numHits;
+    uint64_t m_droppedHits;
+
+    // the write currently being single-stepped
+    uint8_t* m_stepPages[MaxStepPages];
+    int m_numStepPages;
+    Word_t m_stepVaddr;
+
+public:
+    PageGuard(uint8_t* host, Word_t base, Word_t size);
+    ~PageGuard();
+    PageGuard(const PageGuard&) = delete;
+    PageGuard& operator=(const PageGuard&) = delete;
+
+    static bool supported();
+
+    // false if page protection is not supported or the span is not
+    // entirely in guest memory
+    bool watch(int id, Word_t first, Word_t last);
+    void unwatch(int id);
+    void clear();
+    // put the protection back after the host pages were mapped anew
+    void reprotect() { protect(true); }
+
+    // hits since the last call, oldest first. hits beyond MaxHits between
+    // two calls are dropped and counted
+    std::vector<WatchHit> takeHits();
+    uint64_t droppedHits() const { return m_droppedHits; }
+
+    // called from the signal handlers
+    bool beginStep(uint8_t* addr);
+    void endStep();
+
+private:
+    void protect(bool on);
+};
+}  // namespace remu
@@ -0,0 +1,184 @@
+#include "Pipeline.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+
+namespace remu {
+namespace {
+constexpr InstructionFormat g_formats[] = {
+#define INST(id, name, match, mask, format) InstructionFormat::format,
+#include "Instructions.def"
+#undef INST
+};
+
+InstClass classOf(InstId id) {
+    switch (id) {
+        case InstId::Lb:
+        case InstId::Lh:
+        case InstId::Lw:
+        case InstId::Lbu:
+        case InstId::Lhu:
+            return InstClass::Load;
+        case InstId::Sb:
+        case InstId::Sh:
+        case InstId::Sw:
+            return InstClass::Store;
+        case InstId::Beq:
+        case InstId::Bne:
+        case InstId::Blt:
+        case InstId::Bge:
+        case InstId::Bltu:
+        case InstId::Bgeu:
+            return InstClass::Branch;
+        case InstId::Jal:
+        case InstId::Jalr:
+            return InstClass::Jump;
+        case InstId::Mul:
+        case InstId::Mulh:
+        case InstId::Mulhsu:
+        case InstId::Mulhu:
+            return InstClass::Mul;
+        case InstId::Div:
+        case InstId::Divu:
+        case InstId::Rem:
+        case InstId::Remu:
+            return InstClass::Div;
+        case InstId::Csrrw:
+        case InstId::Csrrs:
+        case InstId::Csrrc:
+        case InstId::Csrrwi:
+        case InstId::Csrrsi:
+        case InstId::Csrrci:
+            return InstClass::Csr;
+        case InstId::Mret:
+        case InstId::FenceI:
+        case InstId::SfenceVma:
+            return InstClass::Flush;
+        default:
+            return InstClass::Alu;
+    }
+}
+}  // namespace
+
+bool PipelineConfig::valid() const {
+    uint32_t latencies[] = {mulLatency,    divLatency,  loadUse,
+                            branchPenalty, jumpPenalty, flushPenalty,
+                            l2Latency,     l3Latency,   memLatency};
+    for (uint32_t l : latencies) {
+        if (l > 4096) {
+            return false;
+        }
+    }
+    return mulLatency != 0 && divLatency != 0;
+}
+
+bool parsePipelineConfig(const char *arg, PipelineConfig &c) {
+    uint32_t *fields[] = {&c.mulLatency,    &c.divLatency,  &c.loadUse,
+                          &c.branchPenalty, &c.jumpPenalty, &c.flushPenalty,
+                          &c.l2Latency,     &c.l3Latency,   &c.memLatency};
+    const char *p = arg;
+    for (uint32_t *field : fields) {
+        char *end;
+        unsigned long v = std::strtoul(p, &end, 0);
+        if (end != p) {
+            *field = v;
+        }
+        if (*end == '\0') {
+            return c.valid();
+        }
+        if (*end != ',') {
+            return false;
+        }
+        p = end + 1;
+    }
+    return false;
+}
+
+PipelineModel::PipelineModel(const PipelineConfig &config)
+    : m_config(config),
+      m_loadRd(0),
+      m_caches(nullptr),
+      m_seenReads{0, 0, 0} {
+    for (size_t i = 0; i < m_table.size(); ++i) {
+        InstId id = static_cast<InstId>(i);
+        InstClass k = classOf(id);
+        // the fault pseudo-instructions come after the spec ones, they
+        // read nothing and trap
+        InstructionFormat f = i < std::size(g_formats)
+                                  ? g_formats[i]
+                                  : InstructionFormat::IF_U;
+        bool regSource = f == InstructionFormat::IF_R ||
+                         f == InstructionFormat::IF_I ||
+                         f == InstructionFormat::IF_S ||
+                         f == InstructionFormat::IF_B;
+        bool immCsr = id == InstId::Csrrwi || id == InstId::Csrrsi ||
+                      id == InstId::Csrrci;
+        InstTiming &t = m_table[i];
+        t.execute = k == InstClass::Mul   ? config.mulLatency - 1
+                    : k == InstClass::Div ? config.divLatency - 1
+                                          : 0;
+        t.flush = k == InstClass::Flush ? config.flushPenalty : 0;
+        t.readsRs1 = regSource && !immCsr;
+        t.readsRs2 = f == InstructionFormat::IF_R ||
+                     f == InstructionFormat::IF_S ||
+                     f == InstructionFormat::IF_B;
+        t.load = k == InstClass::Load;
+    }
+}
+
+void PipelineModel::watch(const CacheHierarchy *caches) {
+    m_caches = caches;
+    if (caches != nullptr) {
+        stalledReads(caches->stats(), m_seenReads);
+    }
+}
+
+void PipelineModel::stalledReads(const HierarchyStats &s,
+                                 uint64_t reads[3]) {
+    reads[0] = s.lowerReads[0] - s.writeFills[0];
+    reads[1] = s.lowerReads[1] - s.writeFills[1];
+    reads[2] = s.memReads - s.writeFills[2];
+}
+
+uint64_t PipelineModel::chargeMisses() {
+    if (m_caches == nullptr) {
+        return 0;
+    }
+    // a miss in the L1 waits for the L2, and for the L3 or memory as well
+    // if it misses there too
+    uint64_t reads[3];
+    stalledReads(m_caches->stats(), reads);
+    uint64_t cycles = (reads[0] - m_seenReads[0]) * m_config.l2Latency +
+                      (reads[1] - m_seenReads[1]) * m_config.l3Latency +
+                      (reads[2] - m_seenReads[2]) * m_config.memLatency;
+    for (int i = 0; i < 3; ++i) {
+        m_seenReads[i] = reads[i];
+    }
+    m_stats.cache += cycles;
+    return cycles;
+}
+
+void PipelineModel::print() const {
+    const PipelineStats &s = m_stats;
+    uint64_t cycles = s.cycles();
+    auto share = [cycles](uint64_t part) {
+        return cycles != 0 ? 100.0 * part / cycles : 0.0;
+    };
+    std::printf("%" PRIu64 " cycles, %" PRIu64 " insts, CPI %.3f\n", cycles,
+                s.instructions,
+                s.instructions != 0 ? double(cycles) / s.instructions : 0.0);
+    std::printf("  issue     %12" PRIu64 " (%5.1f%%)\n", s.instructions,
+                share(s.instructions));
+    std::printf("  mul/div   %12" PRIu64 " (%5.1f%%)\n", s.execute,
+                share(s.execute));
+    std::printf("  load-use  %12" PRIu64 " (%5.1f%%)\n", s.loadUse,
+                share(s.loadUse));
+    std::printf("  branches  %12" PRIu64 " (%5.1f%%)\n", s.branches,
+                share(s.branches));
+    std::printf("  flushes   %12" PRIu64 " (%5.1f%%)\n", s.flushes,
+                share(s.flushes));
+    std::printf("  cache     %12" PRIu64 " (%5.1f%%)%s\n", s.cache,
+                share(s.cache), m_caches == nullptr ? ", not simulated" : "");
+}
+}  // namespace remu
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "Cache.h"
+#include "ISA.h"
+#include "Instruction.h"
+
+namespace remu {
+// what an instruction costs, by the stage that holds it up
+enum class InstClass : uint8_t {
+    Alu,
+    Load,
+    Store,
+    Branch,
+    Jump,
+    Mul,
+    Div,
+    Csr,
+    Flush,  // mret, fence.i and sfence.vma, which refetch behind them
+    Count
+};
+
+// a classic IF ID EX MEM WB pipeline, one instruction issued a cycle.
+// latencies are in cycles
+struct PipelineConfig {
+    uint32_t mulLatency = 3;  // cycles mul holds EX, not pipelined
+    uint32_t divLatency = 34;
+    uint32_t loadUse = 1;  // bubble after a load its result is used behind
+    // fetch is redirected from EX after a mispredicted branch or jalr, and
+    // from ID after a jal
+    uint32_t branchPenalty = 2;
+    uint32_t jumpPenalty = 1;
+    uint32_t flushPenalty = 4;  // a trap, mret or fence.i drains it all
+    // a miss in an L1 waits for the level that has the line
+    uint32_t l2Latency = 12;
+    uint32_t l3Latency = 40;
+    uint32_t memLatency = 150;
+
+    // mul and div take a cycle at least, nothing takes over 4096
+    bool valid() const;
+};
+
+// "mul,div,load-use,branch,jump,flush[,l2,l3,mem]", empty fields keep
+// their value
+bool parsePipelineConfig(const char *arg, PipelineConfig &c);
+
+// cycles charged, by what they were charged for
+struct PipelineStats {
+    uint64_t instructions = 0;  // a cycle each to issue
+    uint64_t execute = 0;       // mul and div beyond their first cycle
+    uint64_t loadUse = 0;
+    uint64_t branches = 0;      // mispredicted branches and jumps
+    uint64_t flushes = 0;
+    uint64_t cache = 0;
+
+    uint64_t cycles() const {
+        return instructions + execute + loadUse + branches + flushes + cache;
+    }
+};
+
+// charges cycles to each instruction from a table by InstId, built from
+// its class once. the only state carried between instructions is the
+// register a load just wrote. stalls are additive, as nothing overlaps a
+// stall in order, so misses are charged from the cache hierarchy's
+// counts of lines read below the L1s. writes drain through a write
+// buffer and never stall, and neither do the fills of write misses
+class PipelineModel {
+private:
+    struct InstTiming {
+        uint16_t execute;  // extra cycles in EX
+        uint16_t flush;    // cycles to refill the pipeline behind it
+        bool readsRs1;
+        bool readsRs2;
+        bool load;
+    };
+
+    PipelineConfig m_config;
+    std::array<InstTiming, static_cast<size_t>(InstId::Count)> m_table;
+    uint32_t m_loadRd;  // of the last instruction if a load, else 0
+    PipelineStats m_stats;
+
+    const CacheHierarchy *m_caches;
+    // the hierarchy's counts of lines read for loads and fetches from the
+    // L2, the L3 and memory, as the stalls were last charged up to
+    uint64_t m_seenReads[3];
+
+    static void stalledReads(const HierarchyStats &s, uint64_t reads[3]);
+
+public:
+    // config must be valid
+    explicit PipelineModel(const PipelineConfig &config);
+    ~PipelineModel() = default;
+
+    const PipelineConfig &config() const { return m_config; }
+    const PipelineStats &stats() const { return m_stats; }
+
+    // charge misses in caches from now on, nullptr for none
+    void watch(const CacheHierarchy *caches);
+
+    // d enters the pipeline, after the fetch and before it executes.
+    // returns the cycles it costs, and the misses since the last one
+    uint64_t issue(const DecodedInst &d) {
+        const InstTiming &t = m_table[static_cast<size_t>(d.id)];
+        uint64_t cycles = 1 + t.execute + t.flush;
+        ++m_stats.instructions;
+        m_stats.execute += t.execute;
+        m_stats.flushes += t.flush;
+        if (m_loadRd != 0 && ((t.readsRs1 && d.rs1 == m_loadRd) ||
+                              (t.readsRs2 && d.rs2 == m_loadRd)))
+            [[unlikely]] {
+            cycles += m_config.loadUse;
+            m_stats.loadUse += m_config.loadUse;
+        }
+        // a load of x0 is written to the sink, which nothing reads
+        m_loadRd = t.load ? d.rd : 0;
+        if (m_caches != nullptr) {
+            cycles += chargeMisses();
+        }
+        return cycles;
+    }
+    // misses not charged yet, for when the last instruction of a run has
+    // executed
+    uint64_t chargeMisses();
+
+    // a conditional branch or a jump, resolved after it was issued
+    uint32_t branch(bool mispredicted) {
+        uint32_t cycles = mispredicted ? m_config.branchPenalty : 0;
+        m_stats.branches += cycles;
+        return cycles;
+    }
+    uint32_t jump(bool mispredicted, bool indirect) {
+        uint32_t cycles = !mispredicted ? 0
+                          : indirect    ? m_config.branchPenalty
+                                        : m_config.jumpPenalty;
+        m_stats.branches += cycles;
+        return cycles;
+    }
+    // a trap, or an instruction that refetches
+    uint32_t flush() {
+        m_stats.flushes += m_config.flushPenalty;
+        return m_config.flushPenalty;
+    }
+
+    void print() const;
+};
+}  // namespace remu
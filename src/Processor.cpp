@@ -1,6 +1,10 @@
 
 #include "Processor.h"
 
+#include <algorithm>
+#include <cinttypes>
+
+#include "Semantics.h"
 #include "Util.h"
 
 namespace {
@@ -9,14 +13,6 @@ std::array<std::string_view, remu::RegNum> g_regName{
     "a1", "a2", "a3", "a4", "a5",  "a6",  "a7", "s2", "s3", "s4", "s5",
     "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
 
-template <typename T, unsigned Width>
-inline T signExtend(const T x) {
-    struct {
-        T n : Width;
-    } s = {.n = x};
-    return s.n;
-}
-
 inline Word_t opcode(const Word_t inst) { return inst & 0x7F; }
 
 inline Word_t rd(const Word_t inst) { return (inst >> 7) & 0x1F; }
@@ -61,9 +57,397 @@ inline Word_t immJ(const Word_t inst) {
 inline Word_t pred(const Word_t inst) { return imm<27, 24>(inst); }
 
 inline Word_t succ(const Word_t inst) { return imm<23, 20>(inst); }
+
+// hart state of the threaded interpreter. it never escapes
+// executeThreaded(), so pc, npc and the register file base stay in host
+// registers across the inlined handlers. a trap is only noted here, the
+// executor delivers it, so no handler has to make a call.
+struct LocalHart {
+    Word_t* x;
+    remu::Registers* regs;
+    Word_t curPc;
+    Word_t nextPc;
+    remu::ExceptionCause cause;
+    Word_t tval;
+
+    Word_t& reg(uint32_t i) { return x[i]; }
+    Word_t& pc() { return curPc; }
+    Word_t& npc() { return nextPc; }
+    remu::Registers& csrs() { return *regs; }
+    // a host fault would lose the pc kept in host registers, so accesses
+    // are always checked. the engines running this hart only come
+    // untraced, runs with tracers attached take the traced interpreter
+    using Untraced = remu::AccessPolicy<true, false>;
+    bool trap(remu::ExceptionCause c, Word_t v) {
+        cause = c;
+        tval = v;
+        return false;
+    }
+    // runs with a branch model are traced, and never get here
+    void noteBranch(bool taken, Word_t target) {}
+    void noteJump(const remu::DecodedInst& d, Word_t target, bool indirect) {
+    }
+};
+
+// translated fetches, and those that fault
+[[gnu::noinline]] const remu::DecodedInst& fetchSlow(remu::DecodeCache& cache,
+                                                     remu::Memory& mem,
+                                                     Word_t pc) {
+    Word_t bits;
+    remu::Access a =
+        (pc & 3) != 0 ? remu::Access::Fault : mem.fetch(pc, bits);
+    if (a == remu::Access::Ok) {
+        return cache.lookup(pc, bits);
+    }
+    return a == remu::Access::PageFault ? remu::fetchPageFaultInst()
+                                        : remu::fetchFaultInst();
+}
+
+// the instruction at pc, or a fetch fault pseudo-instruction if it cannot
+// be fetched
+inline const remu::DecodedInst& fetchAt(remu::DecodeCache& cache,
+                                        remu::Memory& mem, Word_t pc) {
+    if (!mem.isDirectFetch(pc) || (pc & 3) != 0) [[unlikely]] {
+        return fetchSlow(cache, mem, pc);
+    }
+    return cache.lookup(pc, mem.vMemFetch(pc));
+}
+
+// the tail-call interpreter. every handler ends by tail-calling the
+// dispatcher, which tail-calls the next handler, so the whole run is one
+// flat chain of jumps and the register base, pc and budget stay in
+// argument registers. without a guaranteed tail call the chain is run
+// in chunks, so the stack stays bounded if the compiler keeps the calls.
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(clang::musttail)
+#define REMU_MUSTTAIL [[clang::musttail]]
+constexpr uint64_t TailCallChunk = UINT64_MAX;
+#elif defined(__has_cpp_attribute) && __has_cpp_attribute(gnu::musttail)
+#define REMU_MUSTTAIL [[gnu::musttail]]
+constexpr uint64_t TailCallChunk = UINT64_MAX;
+#else
+#define REMU_MUSTTAIL
+constexpr uint64_t TailCallChunk = 4096;
+#endif
+
+struct TailContext {
+    remu::Memory& mem;
+    remu::DecodeCache& cache;
+    remu::Registers* regs;
+    Word_t pc;      // where the run stopped
+    uint64_t left;  // budget left when it stopped
+    bool trapped;   // the instruction at pc trapped, with cause and tval
+    remu::ExceptionCause cause;
+    Word_t tval;
+};
+
+using TailHandler = void (*)(TailContext& ctx, Word_t* x, Word_t pc,
+                             uint64_t n, const remu::DecodedInst* d);
+
+#define INST(id, name, match, mask, format)                            \
+    void tail##id(TailContext& ctx, Word_t* x, Word_t pc, uint64_t n, \
+                  const remu::DecodedInst* d);
+#include "Instructions.def"
+#undef INST
+
+#define PSEUDO(id)                                                     \
+    void tail##id(TailContext& ctx, Word_t* x, Word_t pc, uint64_t n, \
+                  const remu::DecodedInst* d);
+REMU_PSEUDO_INSTS(PSEUDO)
+#undef PSEUDO
+
+constexpr TailHandler g_tailHandlers[] = {
+#define INST(id, name, match, mask, format) tail##id,
+#include "Instructions.def"
+#undef INST
+#define PSEUDO(id) tail##id,
+    REMU_PSEUDO_INSTS(PSEUDO)
+#undef PSEUDO
+};
+
+// decode cache misses take a separate step, so the handlers themselves
+// never make a call and need no stack frame
+[[gnu::noinline]] void tailRefill(TailContext& ctx, Word_t* x, Word_t pc,
+                                  uint64_t n, const remu::DecodedInst* d) {
+    d = &fetchAt(ctx.cache, ctx.mem, pc);
+    REMU_MUSTTAIL return g_tailHandlers[static_cast<int>(d->id)](
+        ctx, x, pc, n - 1, d);
+}
+
+// ends the run, the executor delivers the trap
+void tailTrap(TailContext& ctx, Word_t* x, Word_t pc, uint64_t n,
+              const remu::DecodedInst* d) {
+    ctx.pc = pc;
+    ctx.left = n;
+    ctx.trapped = true;
+}
+
+inline void tailDispatch(TailContext& ctx, Word_t* x, Word_t pc, uint64_t n,
+                         const remu::DecodedInst* d) {
+    if (n == 0) [[unlikely]] {
+        ctx.pc = pc;
+        return;
+    }
+    if (!ctx.mem.isDirectFetch(pc)) [[unlikely]] {
+        REMU_MUSTTAIL return tailRefill(ctx, x, pc, n, d);
+    }
+    d = ctx.cache.find(pc, ctx.mem.vMemFetch(pc));
+    if (d == nullptr) [[unlikely]] {
+        REMU_MUSTTAIL return tailRefill(ctx, x, pc, n, d);
+    }
+    REMU_MUSTTAIL return g_tailHandlers[static_cast<int>(d->id)](
+        ctx, x, pc, n - 1, d);
+}
+
+#define PSEUDO(id)                                                        \
+    void tail##id(TailContext& ctx, Word_t* x, Word_t pc, uint64_t n,    \
+                  const remu::DecodedInst* d) {                           \
+        LocalHart hart{                                                   \
+            .x = x, .regs = ctx.regs, .curPc = pc, .nextPc = pc + 4};     \
+        if (!remu::exec##id<LocalHart, LocalHart::Untraced>(              \
+                hart, ctx.mem, *d)) [[unlikely]] {                        \
+            ctx.cause = hart.cause;                                       \
+            ctx.tval = hart.tval;                                         \
+            REMU_MUSTTAIL return tailTrap(ctx, x, pc, n, d);              \
+        }                                                                 \
+        REMU_MUSTTAIL return tailDispatch(ctx, x, hart.nextPc, n, d);     \
+    }
+#define INST(id, name, match, mask, format) PSEUDO(id)
+#include "Instructions.def"
+#undef INST
+REMU_PSEUDO_INSTS(PSEUDO)
+#undef PSEUDO
+
+// the handlers the Processor engines run traced. decoded instructions
+// carry the untraced ones
+constexpr remu::Handler g_tracedHandlers[] = {
+#define PSEUDO(id) \
+    &remu::exec##id<remu::Processor, remu::Processor::Policy<true>>,
+#define INST(id, name, match, mask, format) PSEUDO(id)
+#include "Instructions.def"
+#undef INST
+    REMU_PSEUDO_INSTS(PSEUDO)
+#undef PSEUDO
+};
+
+template <bool Traced>
+inline remu::Handler handlerOf(const remu::DecodedInst& inst) {
+    if constexpr (Traced) {
+        return g_tracedHandlers[static_cast<int>(inst.id)];
+    } else {
+        return inst.handler;
+    }
+}
+
+#if REMU_GUARD_REGION
+// the handlers once more, with checked accesses, and traced as this is
+// off every fast path. a load or store the guard region stopped is run
+// again through these, see execute()
+using CheckedHandler = bool (*)(LocalHart& hart, remu::Memory& mem,
+                                const remu::DecodedInst& d);
+
+constexpr CheckedHandler g_checkedHandlers[] = {
+#define PSEUDO(id) &remu::exec##id<LocalHart, remu::AccessPolicy<true, true>>,
+#define INST(id, name, match, mask, format) PSEUDO(id)
+#include "Instructions.def"
+#undef INST
+    REMU_PSEUDO_INSTS(PSEUDO)
+#undef PSEUDO
+};
+
+// what an instruction that went outside RAM once is rebound to, so that
+// a guest polling a device pays for the host fault only the first time
+constexpr remu::Handler g_boundCheckedHandlers[] = {
+#define PSEUDO(id) \
+    &remu::exec##id<remu::Processor, remu::AccessPolicy<true, false>>,
+#define INST(id, name, match, mask, format) PSEUDO(id)
+#include "Instructions.def"
+#undef INST
+    REMU_PSEUDO_INSTS(PSEUDO)
+#undef PSEUDO
+};
+#endif
 }  // namespace
 
 namespace remu {
+// RV32IM with S and U modes
+constexpr Word_t MisaValue = (1u << 30) | (1u << ('I' - 'A')) |
+                             (1u << ('M' - 'A')) | (1u << ('S' - 'A')) |
+                             (1u << ('U' - 'A'));
+constexpr Word_t MieMask = (1u << 3) | (1u << 7) | (1u << 11);
+constexpr Word_t MstatusWritable =
+    MstatusMIE | MstatusMPIE | MstatusMPRV | MstatusSUM | MstatusMXR;
+
+bool csrAllowed(const Registers& r, uint32_t csr) {
+    return ((csr >> 8) & 3) <= static_cast<Word_t>(r.mode);
+}
+
+bool readCsr(const Registers& r, uint32_t csr, Word_t& value) {
+    if (!csrAllowed(r, csr)) {
+        return false;
+    }
+    switch (csr) {
+        case CsrSatp:
+            value = r.satp;
+            break;
+        case CsrMstatus:
+            value = r.mstatus;
+            break;
+        case CsrMisa:
+            value = MisaValue;
+            break;
+        case CsrMie:
+            value = r.mie;
+            break;
+        case CsrMtvec:
+            value = r.mtvec;
+            break;
+        case CsrMscratch:
+            value = r.mscratch;
+            break;
+        case CsrMepc:
+            value = r.mepc;
+            break;
+        case CsrMcause:
+            value = r.mcause;
+            break;
+        case CsrMtval:
+            value = r.mtval;
+            break;
+        case CsrMip:
+            value = r.mip;
+            break;
+        case CsrMcycle:
+            if (!r.timed) {
+                return false;
+            }
+            value = static_cast<Word_t>(r.mcycle);
+            break;
+        case CsrMcycleh:
+            if (!r.timed) {
+                return false;
+            }
+            value = static_cast<Word_t>(r.mcycle >> 32);
+            break;
+        case CsrMhartid:
+            value = 0;
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+bool writeCsr(Registers& r, Memory& mem, uint32_t csr, Word_t value) {
+    if (!csrAllowed(r, csr)) {
+        return false;
+    }
+    switch (csr) {
+        case CsrSatp:
+            r.satp = value & (SatpMode | SatpPpn);
+            syncTranslation(r, mem);
+            break;
+        case CsrMstatus: {
+            // MPP holds U, S or M, the reserved value keeps the old one
+            Word_t mpp = value & MstatusMPP;
+            if (mpp == (2u << MstatusMPPShift)) {
+                mpp = r.mstatus & MstatusMPP;
+            }
+            r.mstatus = (value & MstatusWritable) | mpp;
+            syncTranslation(r, mem);
+            break;
+        }
+        case CsrMisa:
+            break;
+        case CsrMie:
+            r.mie = value & MieMask;
+            break;
+        case CsrMtvec:
+            // direct or vectored mode
+            r.mtvec = value & ~2u;
+            break;
+        case CsrMscratch:
+            r.mscratch = value;
+            break;
+        case CsrMepc:
+            r.mepc = value & ~3u;
+            break;
+        case CsrMcause:
+            r.mcause = value;
+            break;
+        case CsrMtval:
+            r.mtval = value;
+            break;
+        case CsrMip:
+            // no pending bit is software writable in M-mode
+            break;
+        case CsrMcycle:
+            if (!r.timed) {
+                return false;
+            }
+            r.mcycle = (r.mcycle & ~uint64_t{0xffffffff}) | value;
+            break;
+        case CsrMcycleh:
+            if (!r.timed) {
+                return false;
+            }
+            r.mcycle = (r.mcycle & 0xffffffff) | uint64_t{value} << 32;
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+Word_t takeTrap(Registers& r, Memory& mem, ExceptionCause cause, Word_t pc,
+                Word_t tval) {
+    Word_t code = static_cast<Word_t>(cause);
+    r.mepc = pc;
+    r.mcause = code;
+    r.mtval = tval;
+    Word_t pie = (r.mstatus & MstatusMIE) != 0 ? MstatusMPIE : 0;
+    Word_t pp = static_cast<Word_t>(r.mode) << MstatusMPPShift;
+    r.mstatus =
+        (r.mstatus & ~(MstatusMIE | MstatusMPIE | MstatusMPP)) | pie | pp;
+    r.mode = ProcessorMode::M_MODE;
+    syncTranslation(r, mem);
+    Word_t base = r.mtvec & ~3u;
+    bool interrupt = (code >> 31) != 0;
+    if ((r.mtvec & 1) != 0 && interrupt) {
+        return base + 4 * (code & ~(1u << 31));
+    }
+    return base;
+}
+
+Word_t returnFromTrap(Registers& r, Memory& mem) {
+    Word_t ie = (r.mstatus & MstatusMPIE) != 0 ? MstatusMIE : 0;
+    r.mode = static_cast<ProcessorMode>((r.mstatus & MstatusMPP) >>
+                                        MstatusMPPShift);
+    // MPP drops to U, and MPRV is cleared when leaving M-mode
+    Word_t mprv = r.mode == ProcessorMode::M_MODE ? MstatusMPRV : 0;
+    r.mstatus = (r.mstatus & ~(MstatusMIE | MstatusMPP | MstatusMPRV)) |
+                ie | MstatusMPIE | (r.mstatus & mprv);
+    syncTranslation(r, mem);
+    return r.mepc;
+}
+
+void syncTranslation(const Registers& r, Memory& mem) {
+    bool sv32 = (r.satp & SatpMode) != 0;
+    // loads and stores in M-mode use MPP's level while MPRV is set
+    ProcessorMode dataMode = r.mode;
+    if (r.mode == ProcessorMode::M_MODE && (r.mstatus & MstatusMPRV) != 0) {
+        dataMode = static_cast<ProcessorMode>((r.mstatus & MstatusMPP) >>
+                                              MstatusMPPShift);
+    }
+    mem.setTranslation(Translation{
+        .fetch = sv32 && r.mode != ProcessorMode::M_MODE,
+        .data = sv32 && dataMode != ProcessorMode::M_MODE,
+        .root = uint64_t{r.satp & SatpPpn} << PageShift,
+        .fetchUser = r.mode == ProcessorMode::U_MODE,
+        .dataUser = dataMode == ProcessorMode::U_MODE,
+        .sum = (r.mstatus & MstatusSUM) != 0,
+        .mxr = (r.mstatus & MstatusMXR) != 0});
+}
+
 Word_t Processor::getGeneralRegFromName(const std::string_view name) {
     for (int i = 0; i < g_regName.size(); ++i) {
         if (g_regName[i] == name) {
@@ -74,24 +458,506 @@ Word_t Processor::getGeneralRegFromName(const std::string_view name) {
     return 0;
 }
 
-Instruction Processor::fetchInst() {
-    Word_t bits = m_mem.vMemRead<Word_t>(m_pc);
+const DecodedInst& Processor::fetchInst() {
     m_npc = m_pc + 4;
-    Instruction inst(bits);
-    return inst;
+    return fetchAt(m_decodeCache, m_mem, m_pc);
+}
+
+// m_pc is already at the trap handler. if the handler cannot be fetched
+// either, every instruction from here on would trap again, so the hart
+// stops: an ebreak without a handler ends the program, anything else
+// aborts it
+bool Processor::trapped() {
+    Word_t bits;
+    if (m_mem.isDirectFetch(m_pc) ||
+        m_mem.fetch(m_pc, bits) == Access::Ok) [[likely]] {
+        return true;
+    }
+    m_state = m_regs.mcause == static_cast<Word_t>(ExceptionCause::Breakpoint)
+                  ? REMUState::END
+                  : REMUState::ABORT;
+    return false;
 }
 
 void Processor::execute(uint64_t n) {
-    while ((n--) > 0) [[likely]] {
-        // fetch
-        Instruction inst = fetchInst();
-        // decode
-        auto op = inst.decode();
+    if (m_state != REMUState::RUNNING) {
+        return;
+    }
+    m_hostCounters.enable();
+#if REMU_GUARD_REGION
+    // loads and stores outside RAM fault on the host and land here. the
+    // engines running Processor handlers keep m_pc and m_executed exact
+    // across handler calls, so m_pc is the instruction that faulted. it
+    // has changed nothing yet, and is run again checked, which takes it
+    // to the bus or raises the access fault. its decoded copies are
+    // rebound to checked handlers, as it is likely to go there again
+    GuestFault fault;
+    uint64_t start = m_executed;
+    if (sigsetjmp(fault.env, 0) != 0) {
+        LocalHart hart{.x = m_regs.x.data(),
+                       .regs = &m_regs,
+                       .curPc = m_pc,
+                       .nextPc = m_pc + 4};
+        const DecodedInst& d = fetchAt(m_decodeCache, m_mem, m_pc);
+        bool ok = g_checkedHandlers[static_cast<int>(d.id)](hart, m_mem, d);
+        Handler checked = g_boundCheckedHandlers[static_cast<int>(d.id)];
+        m_decodeCache.rebind(m_pc, d.bits, checked);
+        m_blockCache.rebind(m_pc, checked);
+        m_npc = ok ? hart.nextPc : takeTrap(m_regs, m_mem, hart.cause, m_pc,
+                                            hart.tval);
+        m_pc = m_npc;
+        ++m_executed;
+        // it was issued before it faulted on the host
+        if (!ok && m_pipeline != nullptr) {
+            m_regs.mcycle += m_pipeline->flush();
+        }
+        if (!ok && !trapped()) {
+            m_mem.armGuestFault(nullptr);
+            m_hostCounters.disable();
+            return;
+        }
+    }
+    m_mem.armGuestFault(&fault);
+    run(n - (m_executed - start));
+    m_mem.armGuestFault(nullptr);
+#else
+    run(n);
+#endif
+    m_hostCounters.disable();
+}
+
+// tracers, the observer and the models are only attached between runs,
+// so a run without them takes the engines compiled without tracing
+void Processor::run(uint64_t n) {
+    if (m_mem.hasTracers() || m_branches != nullptr ||
+        m_pipeline != nullptr) {
+        runEngine<true>(n);
+    } else {
+        runEngine<false>(n);
+    }
+    // the last instruction's misses
+    if (m_pipeline != nullptr) {
+        m_regs.mcycle += m_pipeline->chargeMisses();
+    }
+}
+
+template <bool Traced>
+void Processor::runEngine(uint64_t n) {
+    switch (m_engine) {
+        case ExecEngine::Threaded:
+        case ExecEngine::TailCall:
+            if constexpr (Traced) {
+                executeInterpreter<true>(n);
+            } else if (m_engine == ExecEngine::Threaded) {
+                executeThreaded(n);
+            } else {
+                executeTailCall(n);
+            }
+            break;
+        case ExecEngine::Block:
+        case ExecEngine::Jit:
+        case ExecEngine::Tiered:
+            executeBlocks<Traced>(n);
+            break;
+        case ExecEngine::Interpreter:
+        default:
+            executeInterpreter<Traced>(n);
+            break;
+    }
+}
+
+HartState Processor::saveState() const {
+    return HartState{.pc = m_pc,
+                     .npc = m_npc,
+                     .regs = m_regs,
+                     .state = m_state,
+                     .executed = m_executed,
+                     .engine = m_engine,
+                     .tier = m_tier.config()};
+}
+
+void Processor::restoreState(const HartState& s) {
+    m_pc = s.pc;
+    m_npc = s.npc;
+    m_regs = s.regs;
+    m_regs.timed = m_pipeline != nullptr;
+    m_state = s.state;
+    m_executed = s.executed;
+    m_engine = s.engine;
+    setTierConfig(s.tier);
+    syncTranslation(m_regs, m_mem);
+}
+
+void Processor::setTierConfig(const TierConfig& c) {
+    m_tier.setConfig(c);
+    m_blockCache.setTraceThreshold(c.traceThreshold);
+}
+
+TierStats Processor::getTierStats() {
+    TierStats stats = m_tier.stats();
+    stats.blocksTranslated = m_blockCache.translatedCount();
+    stats.tracesFormed = m_blockCache.tracesFormedCount();
+    return stats;
+}
+
+void Processor::printTierStats() {
+    TierStats s = getTierStats();
+    std::printf("interpreted: %" PRIu64 " insts\n", s.interpreted);
+    std::printf("blocks:      %" PRIu64 " insts, %" PRIu64 " blocks, %" PRIu64
+                " traces\n",
+                s.blockInsts, s.blocksTranslated, s.tracesFormed);
+    std::printf("native:      %" PRIu64 " insts, %" PRIu64
+                " compiled, %" PRIu64 " flushes\n",
+                s.nativeInsts, s.nativeCompiled, s.nativeFlushes);
+}
+
+bool Processor::enableCaches(const HierarchyConfig& c) {
+    if (!c.valid()) {
+        return false;
+    }
+    disableCaches();
+    m_caches = std::make_unique<CacheHierarchy>(m_mem.getBus(), c);
+    m_mem.setObserver(&m_caches->port(0));
+    if (m_pipeline != nullptr) {
+        m_pipeline->watch(m_caches.get());
+    }
+    return true;
+}
+
+bool Processor::enableCacheSweep(std::vector<HierarchyConfig> configs,
+                                 unsigned threads) {
+    if (configs.empty() ||
+        !std::all_of(configs.begin(), configs.end(),
+                     [](const HierarchyConfig& c) { return c.valid(); })) {
+        return false;
+    }
+    disableCaches();
+    m_sweep = std::make_unique<CacheSweep>(m_mem.getBus(), std::move(configs),
+                                           threads);
+    m_mem.setObserver(m_sweep.get());
+    return true;
+}
+
+void Processor::disableCaches() {
+    if (m_caches != nullptr || m_sweep != nullptr) {
+        if (m_pipeline != nullptr) {
+            m_pipeline->watch(nullptr);
+        }
+        m_mem.setObserver(nullptr);
+        m_caches.reset();
+        m_sweep.reset();
+    }
+}
+
+void Processor::printCacheStats() const {
+    if (m_sweep != nullptr) {
+        m_sweep->print(m_executed);
+    } else if (m_caches != nullptr) {
+        m_caches->print(m_executed);
+    } else {
+        std::printf("caches not simulated\n");
+    }
+}
+
+bool Processor::enableBranchModel(const BranchConfig& c) {
+    if (!c.valid()) {
+        return false;
+    }
+    m_branches = std::make_unique<BranchModel>(c);
+    return true;
+}
+
+void Processor::printBranchStats() const {
+    if (m_branches != nullptr) {
+        m_branches->print(m_executed);
+    } else {
+        std::printf("branches not simulated\n");
+    }
+}
+
+bool Processor::enableTiming(const PipelineConfig& c) {
+    if (!c.valid()) {
+        return false;
+    }
+    // a sweep has no one hierarchy to take the misses of
+    m_pipeline = std::make_unique<PipelineModel>(c);
+    m_pipeline->watch(m_caches.get());
+    m_regs.timed = true;
+    return true;
+}
+
+void Processor::printTimingStats() const {
+    if (m_pipeline != nullptr) {
+        m_pipeline->print();
+        std::printf("mcycle %" PRIu64 "\n", m_regs.mcycle);
+    } else {
+        std::printf("timing not modelled\n");
+    }
+}
+
+void Processor::printHostStats() const {
+    if (!m_hostCounters.available()) {
+        std::printf("host counters not available\n");
+        return;
+    }
+    HostCounterValues v = m_hostCounters.read();
+    double rate =
+        v.dtlbLoads != 0 ? 100.0 * v.dtlbLoadMisses / v.dtlbLoads : 0.0;
+    std::printf("dTLB loads:  %" PRIu64 ", %" PRIu64 " misses (%.3f%%)\n",
+                v.dtlbLoads, v.dtlbLoadMisses, rate);
+}
+
+template <bool Traced>
+void Processor::executeInterpreter(uint64_t n) {
+    // tier counts go up before each handler runs, so that one faulting
+    // on the host, which execute() finishes, is counted as well
+    uint64_t& interpreted = m_tier.stats().interpreted;
+    uint64_t i = 0;
+    while (i < n) [[likely]] {
+        // fetch & decode
+        const DecodedInst& inst = fetchInst();
+        if constexpr (Traced) {
+            m_mem.observeFetch(m_pc);
+            noteIssue(inst);
+        }
+        ++interpreted;
         // execute
-        op(*this, m_mem, inst.getBits());
+        bool ok = handlerOf<Traced>(inst)(*this, m_mem, inst);
+        m_pc = m_npc;
+        ++i;
+        ++m_executed;
+        if (!ok) [[unlikely]] {
+            if (!trapped()) {
+                break;
+            }
+        }
+    }
+}
+
+// the interpreter tier: run up to the next taken control transfer, where
+// a block may start
+template <bool Traced>
+uint64_t Processor::executeCold(uint64_t n) {
+    uint64_t& interpreted = m_tier.stats().interpreted;
+    uint64_t i = 0;
+    while (i < n) {
+        const DecodedInst& inst = fetchInst();
+        if constexpr (Traced) {
+            m_mem.observeFetch(m_pc);
+            noteIssue(inst);
+        }
+        ++interpreted;
+        bool ok = handlerOf<Traced>(inst)(*this, m_mem, inst);
+        ++i;
+        ++m_executed;
+        bool jumped = m_npc != m_pc + 4;
         m_pc = m_npc;
+        if (!ok) [[unlikely]] {
+            trapped();
+            break;
+        }
+        if (jumped) {
+            break;
+        }
     }
+    return i;
+}
+
+template <bool Traced>
+void Processor::executeBlocks(uint64_t n) {
+    bool tiered = m_engine == ExecEngine::Tiered;
+    // translated loads bypass the read tracers and the observer, which
+    // sees no fetches of native code either, and translated code the
+    // models. stores leave native code on pages a write tracer covers
+    bool native = m_engine != ExecEngine::Block && m_jit.enabled() &&
+                  !m_mem.hasReadTracers() && m_mem.observer() == nullptr &&
+                  m_branches == nullptr && m_pipeline == nullptr;
+    TierStats& stats = m_tier.stats();
+    Memory& mem = m_mem;
+    JitContext ctx{.regs = m_regs.x.data(),
+                   .ram = m_mem.hostBase(),
+                   .pageFlags = m_mem.pageFlags()};
+    Block* prev = nullptr;
+    while (n > 0) {
+        // a block reached without a chained edge is looked up here, and
+        // chained. blocks are keyed by physical pc and translated code
+        // bypasses the TLB, so while anything is translated, and for a pc
+        // that cannot be fetched, the interpreter runs. blocks that may
+        // turn translation on are never chained, so it is noticed here
+        if (!m_mem.isDirectFetch(m_pc) || m_mem.translation().data ||
+            (tiered && !m_tier.warm(m_pc))) {
+            n -= executeCold<Traced>(n);
+            if (m_state != REMUState::RUNNING) {
+                return;
+            }
+            prev = nullptr;
+            continue;
+        }
+        Block* b = m_blockCache.lookup(m_pc);
+        if (prev != nullptr && prev->valid) {
+            m_blockCache.link(prev, m_pc, b);
+        }
+        // nothing runs between blocks here, so invalidated ones can go
+        m_blockCache.releaseRetired();
+
+        // run b and then the blocks chained after it, until an edge is
+        // not chained yet. only a trace can be left off its recorded
+        // path, a plain block runs to its end unless it traps or a store
+        // invalidates it
+        while (b != nullptr) {
+            b = m_blockCache.enter(prev, b);
+            if (b->size > n) {
+                // not enough budget left for a whole block
+                executeInterpreter<Traced>(n);
+                return;
+            }
+
+            uint32_t i = 0;
+            if (native) {
+                if (b->native == nullptr && m_tier.hot(b->execCount)) {
+                    if (m_jit.compile(b)) {
+                        ++stats.nativeCompiled;
+                    } else {
+                        // out of code space, start over
+                        m_blockCache.flush();
+                        m_jit.reset();
+                        ++stats.nativeFlushes;
+                    }
+                }
+                if (b->native != nullptr) {
+                    b->native(&ctx);
+                    m_pc = ctx.pc;
+                    i = ctx.executed;
+                    stats.nativeInsts += i;
+                    m_executed += i;
+                }
+            }
+            // interpret the block, or whatever the native code left over.
+            // the instructions stay in place while the block runs, a store
+            // that invalidates it only drops its size
+            bool ok = true;
+            const DecodedInst* insts = b->insts.data();
+            const Word_t* pcs = b->isTrace ? b->pcs.data() : nullptr;
+            for (; i < b->size && (pcs == nullptr || m_pc == pcs[i]); ++i) {
+                const DecodedInst& inst = insts[i];
+                m_npc = m_pc + 4;
+                if constexpr (Traced) {
+                    m_mem.observeFetch(m_pc);
+                    noteIssue(inst);
+                }
+                ++stats.blockInsts;
+                ok = handlerOf<Traced>(inst)(*this, mem, inst);
+                m_pc = m_npc;
+                ++m_executed;
+                if (!ok) [[unlikely]] {
+                    ++i;
+                    break;
+                }
+            }
+            n -= i;
+            prev = b;
+            if (!ok) [[unlikely]] {
+                if (!trapped()) {
+                    return;
+                }
+                // the edge into the trap handler is not chained
+                prev = nullptr;
+                break;
+            }
+            b = b->valid && n > 0 ? b->chain(m_pc) : nullptr;
+        }
+    }
+}
+
+void Processor::executeTailCall(uint64_t n) {
+    TailContext ctx{
+        .mem = m_mem, .cache = m_decodeCache, .regs = &m_regs, .pc = m_pc};
+    while (n > 0) {
+        uint64_t chunk = std::min(n, TailCallChunk);
+        ctx.left = 0;
+        ctx.trapped = false;
+        tailDispatch(ctx, m_regs.x.data(), ctx.pc, chunk, nullptr);
+        n -= chunk - ctx.left;
+        m_executed += chunk - ctx.left;
+        if (ctx.trapped) [[unlikely]] {
+            m_pc = ctx.pc;
+            trap(ctx.cause, ctx.tval);
+            ctx.pc = m_pc = m_npc;
+            if (!trapped()) {
+                break;
+            }
+        }
+    }
+    m_pc = ctx.pc;
+    m_npc = m_pc;
+}
+
+#if defined(__GNUC__)
+void Processor::executeThreaded(uint64_t n) {
+    static const void* const labels[] = {
+#define INST(id, name, match, mask, format) &&L_##id,
+#include "Instructions.def"
+#undef INST
+#define PSEUDO(id) &&L_##id,
+        REMU_PSEUDO_INSTS(PSEUDO)
+#undef PSEUDO
+    };
+
+    uint64_t budget = n;
+    LocalHart hart{.x = m_regs.x.data(),
+                   .regs = &m_regs,
+                   .curPc = m_pc,
+                   .nextPc = m_npc};
+    Memory& mem = m_mem;
+    const DecodedInst* d;
+
+    // every handler ends with its own copy of the dispatch sequence, so
+    // each one gets a separate indirect branch to predict
+#define DISPATCH()                                                     \
+    do {                                                               \
+        if (n == 0) [[unlikely]] {                                     \
+            goto done;                                                 \
+        }                                                              \
+        --n;                                                           \
+        d = &fetchAt(m_decodeCache, mem, hart.curPc);                  \
+        hart.nextPc = hart.curPc + 4;                                  \
+        goto *labels[static_cast<int>(d->id)];                         \
+    } while (0)
+
+    DISPATCH();
+
+#define PSEUDO(id)                                                       \
+    L_##id:                                                              \
+    if (!exec##id<LocalHart, LocalHart::Untraced>(hart, mem, *d))        \
+        [[unlikely]] {                                                   \
+        goto trap;                                                       \
+    }                                                                    \
+    hart.curPc = hart.nextPc;                                            \
+    DISPATCH();
+#define INST(id, name, match, mask, format) PSEUDO(id)
+#include "Instructions.def"
+#undef INST
+    REMU_PSEUDO_INSTS(PSEUDO)
+#undef PSEUDO
+
+trap:
+    hart.nextPc =
+        takeTrap(m_regs, m_mem, hart.cause, hart.curPc, hart.tval);
+    hart.curPc = hart.nextPc;
+    m_pc = hart.curPc;
+    if (trapped()) {
+        DISPATCH();
+    }
+#undef DISPATCH
+
+done:
+    m_pc = hart.curPc;
+    m_npc = hart.nextPc;
+    m_executed += budget - n;
 }
+#else
+void Processor::executeThreaded(uint64_t n) { executeInterpreter<false>(n); }
+#endif
 
 void Processor::printGeneralReg() const {
     for (int i = 0; i < g_regName.size(); i += 4) {
@@ -2,19 +2,36 @@
 
 #include <array>
 #include <cstdint>
+#include <memory>
 #include <string_view>
 
+#include "BlockCache.h"
+#include "BranchModel.h"
+#include "Cache.h"
+#include "CacheSweep.h"
+#include "DecodeCache.h"
+#include "Exception.h"
+#include "HostCounters.h"
 #include "ISA.h"
 #include "Instruction.h"
+#include "Jit.h"
 #include "Memory.h"
+#include "Pipeline.h"
+#include "REMUState.h"
+#include "Tiering.h"
 
 namespace remu {
 constexpr int RegNum = 32;
 constexpr int RegWidth = 32;
 constexpr int XLEN = RegWidth;
 
+// privilege levels, valued as in mstatus.MPP
+enum class ProcessorMode { U_MODE = 0, S_MODE = 1, M_MODE = 3 };
+
 struct Registers {
-    std::array<Word_t, RegNum> x;  // general Registers
+    // general Registers, x[RegNum] is a write sink for instructions whose
+    // rd is x0, so handlers never have to special-case it
+    std::array<Word_t, RegNum + 1> x;
 
     // Contral Status Registers
     // Machine Mode
@@ -26,9 +43,86 @@ struct Registers {
     Word_t mtval;     // Machine Trap Value Register
     Word_t mepc;      // Machine Exception Program Counter
     Word_t mscratch;  // Machine Scratch
+
+    ProcessorMode mode;  // current privilege level
+    // Supervisor Mode
+    Word_t satp;  // Supervisor Address Translation and Protection
+
+    // counted by the pipeline model, see PipelineModel. nothing counts it
+    // without one, so it only exists while timed, and accesses to it are
+    // illegal otherwise
+    uint64_t mcycle;
+    bool timed;
+};
+
+// CSR addresses. bits 9:8 hold the lowest privilege level allowed to
+// access a CSR
+enum CsrAddr : uint32_t {
+    CsrSatp = 0x180,
+    CsrMstatus = 0x300,
+    CsrMisa = 0x301,
+    CsrMie = 0x304,
+    CsrMtvec = 0x305,
+    CsrMscratch = 0x340,
+    CsrMepc = 0x341,
+    CsrMcause = 0x342,
+    CsrMtval = 0x343,
+    CsrMip = 0x344,
+    CsrMcycle = 0xB00,
+    CsrMcycleh = 0xB80,
+    CsrMhartid = 0xF14
 };
 
-enum class ProcessorMode { U_MODE, S_MODE, M_MODE };
+// mstatus fields
+constexpr Word_t MstatusMIE = 1u << 3;
+constexpr Word_t MstatusMPIE = 1u << 7;
+constexpr Word_t MstatusMPP = 3u << 11;
+constexpr int MstatusMPPShift = 11;
+constexpr Word_t MstatusMPRV = 1u << 17;
+constexpr Word_t MstatusSUM = 1u << 18;
+constexpr Word_t MstatusMXR = 1u << 19;
+
+// satp fields, Sv32 with no ASID bits
+constexpr Word_t SatpMode = 1u << 31;
+constexpr Word_t SatpPpn = (1u << 22) - 1;
+
+// read or write a CSR, false if it does not exist, is read-only or needs
+// a higher privilege level
+bool readCsr(const Registers& r, uint32_t csr, Word_t& value);
+bool writeCsr(Registers& r, Memory& mem, uint32_t csr, Word_t value);
+
+// enter the machine-mode trap handler for a trap taken at pc. returns the
+// pc to continue at. kept out of line, off the handlers' fast paths
+[[gnu::cold, gnu::noinline]] Word_t takeTrap(Registers& r, Memory& mem,
+                                             ExceptionCause cause, Word_t pc,
+                                             Word_t tval);
+// return from the trap handler, returns the pc to continue at
+Word_t returnFromTrap(Registers& r, Memory& mem);
+
+// writeCsr, takeTrap and returnFromTrap keep Memory's translation in step
+// with the hart through this
+void syncTranslation(const Registers& r, Memory& mem);
+
+enum class ExecEngine {
+    Interpreter,  // fetch, decode and call one handler per step
+    Threaded,     // computed goto from one handler to the next
+    TailCall,     // every handler tail-calls the next one
+    Block,        // run cached, chained basic blocks
+    Jit,          // blocks, translated to host code once they get hot
+    Tiered        // interpreter, then blocks once warm, then native code
+};
+
+// what a hart carries over into a clone of its machine. caches and
+// translated code are left behind, the clone warms up its own
+struct HartState {
+    Word_t pc;
+    Word_t npc;
+    Registers regs;
+    REMUState state;
+    uint64_t executed;
+    ExecEngine engine;
+    TierConfig tier;
+};
 
 class Processor {
 private:
@@ -37,30 +131,164 @@ private:
     Registers m_regs;
 
     Memory& m_mem;
+    DecodeCache m_decodeCache;
+    BlockCache m_blockCache;
+    Jit m_jit;
+    TierManager m_tier;
+    ExecEngine m_engine;
+    REMUState m_state;
+    uint64_t m_executed;  // instructions run, trapped ones included
+    HostCounters m_hostCounters;  // count inside execute() once opened
+    // observes m_mem through its first port while set
+    std::unique_ptr<CacheHierarchy> m_caches;
+    std::unique_ptr<CacheSweep> m_sweep;  // observes m_mem while set
+    // fed by the traced branch and jump handlers while set
+    std::unique_ptr<BranchModel> m_branches;
+    // charges cycles to mcycle as the traced engines run while set
+    std::unique_ptr<PipelineModel> m_pipeline;
 
     friend class Debugger;
 
 public:
-    Processor(Memory& m) : m_pc(MemBase), m_npc(m_pc), m_mem(m) {
-        Instruction::init();
-    }
-    ~Processor() = default;
+    Processor(Memory& m)
+        : m_pc(m.getBase()),
+          m_npc(m_pc),
+          m_regs{.mstatus = MstatusMPP, .mode = ProcessorMode::M_MODE},
+          m_mem(m),
+          m_blockCache(m),
+          m_jit(m.getBase(), m.getSize()),
+          m_engine(ExecEngine::Tiered),
+          m_state(REMUState::RUNNING),
+          m_executed(0) {}
+    ~Processor() { disableCaches(); }
 
     Word_t& pc() { return m_pc; }
 
     Word_t& npc() { return m_npc; }
 
     Word_t& reg(uint32_t i) { return m_regs.x[i]; }
+    Registers& csrs() { return m_regs; }
+    // the policy handlers run under. untraced loads and stores outside RAM
+    // fault on the host instead, execute() runs them again checked and
+    // has them run checked from then on. traced runs check, a bounds test
+    // is nothing next to the tracing
+    template <bool Traced>
+    using Policy = AccessPolicy<!HasGuardRegion || Traced, Traced>;
+
+    // handlers call this to raise an exception on the current instruction.
+    // always returns false, which handlers pass on to the executor
+    bool trap(ExceptionCause cause, Word_t tval) {
+        m_npc = takeTrap(m_regs, m_mem, cause, m_pc, tval);
+        if (m_pipeline != nullptr) {
+            m_regs.mcycle += m_pipeline->flush();
+        }
+        return false;
+    }
+
+    // the traced engines report every instruction at pc before it runs
+    void noteIssue(const DecodedInst& d) {
+        if (m_pipeline != nullptr) {
+            m_regs.mcycle += m_pipeline->issue(d);
+        }
+    }
+    // the traced handlers report every conditional branch, jal and jalr
+    // at pc, before it jumps. without a branch model fetch runs on past
+    // untaken branches only
+    void noteBranch(bool taken, Word_t target) {
+        bool mispredicted = taken;
+        if (m_branches != nullptr) {
+            mispredicted = m_branches->branch(m_pc, taken, target);
+        }
+        if (m_pipeline != nullptr) {
+            m_regs.mcycle += m_pipeline->branch(mispredicted);
+        }
+    }
+    void noteJump(const DecodedInst& d, Word_t target, bool indirect) {
+        bool mispredicted = true;
+        if (m_branches != nullptr) {
+            mispredicted =
+                m_branches->jump(m_pc, target, d.rd, d.rs1, indirect);
+        }
+        if (m_pipeline != nullptr) {
+            m_regs.mcycle += m_pipeline->jump(mispredicted, indirect);
+        }
+    }
+
+    // RUNNING until the hart hits a trap it cannot take
+    REMUState getState() const { return m_state; }
     Word_t getGeneralRegFromName(const std::string_view name);
 
     Memory& getMemory() { return m_mem; }
 
     void printGeneralReg() const;
 
+    ExecEngine getEngine() const { return m_engine; }
+    void setEngine(ExecEngine e) { m_engine = e; }
+
+    const TierConfig& getTierConfig() const { return m_tier.config(); }
+    void setTierConfig(const TierConfig& c);
+    TierStats getTierStats();
+    void printTierStats();
+
+    // host dTLB counters, false if the host does not provide them
+    bool openHostCounters() { return m_hostCounters.open(); }
+    void printHostStats() const;
+
+    // simulate a cache hierarchy fed by this hart's fetches, loads and
+    // stores, from empty. runs take the traced engines while it is on.
+    // false if the config is not valid
+    bool enableCaches(const HierarchyConfig& c);
+    // simulate all of configs at once instead, on worker threads, see
+    // CacheSweep
+    bool enableCacheSweep(std::vector<HierarchyConfig> configs,
+                          unsigned threads = 0);
+    void disableCaches();
+    CacheHierarchy* getCaches() { return m_caches.get(); }
+    CacheSweep* getCacheSweep() { return m_sweep.get(); }
+    void printCacheStats() const;
+
+    // predict this hart's control transfers with a fresh BranchModel.
+    // runs take the traced engines while it is on. false if the config
+    // is not valid
+    bool enableBranchModel(const BranchConfig& c);
+    void disableBranchModel() { m_branches.reset(); }
+    BranchModel* getBranchModel() { return m_branches.get(); }
+    void printBranchStats() const;
+
+    // charge mcycle by a fresh PipelineModel, with the misses of the cache
+    // hierarchy if one is simulated and the mispredicts of the branch
+    // model if there is one. runs take the traced engines while it is on.
+    // false if the config is not valid
+    bool enableTiming(const PipelineConfig& c);
+    void disableTiming() {
+        m_pipeline.reset();
+        m_regs.timed = false;
+    }
+    PipelineModel* getPipeline() { return m_pipeline.get(); }
+    void printTimingStats() const;
+
     void execute(uint64_t n);
 
+    HartState saveState() const;
+    void restoreState(const HartState& s);
+
 private:
+    void run(uint64_t n);
+    // the engines, instantiated untraced and traced
+    template <bool Traced>
+    void runEngine(uint64_t n);
+    template <bool Traced>
+    void executeInterpreter(uint64_t n);
+    void executeThreaded(uint64_t n);
+    void executeTailCall(uint64_t n);
+    template <bool Traced>
+    void executeBlocks(uint64_t n);
+    template <bool Traced>
+    uint64_t executeCold(uint64_t n);
+
     void init();
-    Instruction fetchInst();
+    const DecodedInst& fetchInst();
+    // called after a handler trapped, false if execution has to stop
+    bool trapped();
 };
 }  // namespace remu
\ No newline at end of file
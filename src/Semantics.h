@@ -0,0 +1,460 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Exception.h"
+#include "ISA.h"
+#include "Instruction.h"
+#include "Memory.h"
+#include "Processor.h"
+
+// semantics of every mnemonic in Instructions.def, written once against a
+// generic hart. Hart provides reg(i), pc(), npc(), csrs() and trap(cause,
+// tval), and noteBranch and noteJump for traced runs; Processor is one,
+// the threaded interpreter instantiates them with a hart kept in host
+// locals. Policy is the AccessPolicy loads and stores
+// are made under. handlers return false when the instruction trapped.
+namespace remu {
+
+// RV32I integer register-register
+template <typename Hart, typename Policy>
+inline bool execAdd(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) + cpu.reg(d.rs2);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execSub(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) - cpu.reg(d.rs2);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execSll(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) << (cpu.reg(d.rs2) & 0x1F);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execSlt(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = (int32_t)cpu.reg(d.rs1) < (int32_t)cpu.reg(d.rs2);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execSltu(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) < cpu.reg(d.rs2);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execXor(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) ^ cpu.reg(d.rs2);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execSrl(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) >> (cpu.reg(d.rs2) & 0x1F);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execSra(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = (int32_t)cpu.reg(d.rs1) >> (cpu.reg(d.rs2) & 0x1F);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execOr(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) | cpu.reg(d.rs2);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execAnd(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) & cpu.reg(d.rs2);
+    return true;
+}
+
+// RV32M
+template <typename Hart, typename Policy>
+inline bool execMul(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) * cpu.reg(d.rs2);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execMulh(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = ((int64_t)(int32_t)cpu.reg(d.rs1) *
+                     (int64_t)(int32_t)cpu.reg(d.rs2)) >>
+                    XLEN;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execMulhsu(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) =
+        ((int64_t)(int32_t)cpu.reg(d.rs1) * (int64_t)cpu.reg(d.rs2)) >> XLEN;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execMulhu(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) =
+        ((uint64_t)cpu.reg(d.rs1) * (uint64_t)cpu.reg(d.rs2)) >> XLEN;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execDiv(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    int32_t a = cpu.reg(d.rs1);
+    int32_t b = cpu.reg(d.rs2);
+    if (b == 0) {
+        cpu.reg(d.rd) = -1;
+    } else if (a == INT32_MIN && b == -1) {
+        cpu.reg(d.rd) = a;
+    } else {
+        cpu.reg(d.rd) = a / b;
+    }
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execDivu(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    Word_t b = cpu.reg(d.rs2);
+    cpu.reg(d.rd) = b == 0 ? ~0u : cpu.reg(d.rs1) / b;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execRem(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    int32_t a = cpu.reg(d.rs1);
+    int32_t b = cpu.reg(d.rs2);
+    if (b == 0) {
+        cpu.reg(d.rd) = a;
+    } else if (a == INT32_MIN && b == -1) {
+        cpu.reg(d.rd) = 0;
+    } else {
+        cpu.reg(d.rd) = a % b;
+    }
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execRemu(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    Word_t b = cpu.reg(d.rs2);
+    cpu.reg(d.rd) = b == 0 ? cpu.reg(d.rs1) : cpu.reg(d.rs1) % b;
+    return true;
+}
+
+// loads & stores, an access that neither RAM nor the bus takes raises an
+// access fault and one the page table refuses a page fault. executors
+// that can recover from a host fault run unchecked policies and leave the
+// check to the guard region, see Memory
+template <typename Policy, typename T, typename Hart>
+inline bool load(Hart& cpu, Memory& mem, const DecodedInst& d, T& data) {
+    Word_t vaddr = cpu.reg(d.rs1) + d.imm;
+    Access a = mem.vMemReadWithTrace<T, Policy>(vaddr, data);
+    if (a != Access::Ok) [[unlikely]] {
+        return cpu.trap(a == Access::PageFault
+                            ? ExceptionCause::LoadPageFault
+                            : ExceptionCause::LoadAccessFault,
+                        vaddr);
+    }
+    return true;
+}
+template <typename Policy, typename T, typename Hart>
+inline bool store(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    Word_t vaddr = cpu.reg(d.rs1) + d.imm;
+    Access a = mem.vMemWriteWithTrace<T, Policy>(vaddr, cpu.reg(d.rs2));
+    if (a != Access::Ok) [[unlikely]] {
+        return cpu.trap(a == Access::PageFault
+                            ? ExceptionCause::StoreAmoPageFault
+                            : ExceptionCause::StoreAmoAccessFault,
+                        vaddr);
+    }
+    return true;
+}
+
+template <typename Hart, typename Policy>
+inline bool execLb(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    uint8_t data;
+    if (!load<Policy>(cpu, mem, d, data)) [[unlikely]] {
+        return false;
+    }
+    cpu.reg(d.rd) = signExtend<int32_t, 8>(data);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execLh(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    uint16_t data;
+    if (!load<Policy>(cpu, mem, d, data)) [[unlikely]] {
+        return false;
+    }
+    cpu.reg(d.rd) = signExtend<int32_t, 16>(data);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execLw(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    uint32_t data;
+    if (!load<Policy>(cpu, mem, d, data)) [[unlikely]] {
+        return false;
+    }
+    cpu.reg(d.rd) = data;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execLbu(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    uint8_t data;
+    if (!load<Policy>(cpu, mem, d, data)) [[unlikely]] {
+        return false;
+    }
+    cpu.reg(d.rd) = data;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execLhu(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    uint16_t data;
+    if (!load<Policy>(cpu, mem, d, data)) [[unlikely]] {
+        return false;
+    }
+    cpu.reg(d.rd) = data;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execSb(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return store<Policy, uint8_t>(cpu, mem, d);
+}
+template <typename Hart, typename Policy>
+inline bool execSh(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return store<Policy, uint16_t>(cpu, mem, d);
+}
+template <typename Hart, typename Policy>
+inline bool execSw(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return store<Policy, uint32_t>(cpu, mem, d);
+}
+
+// integer register-immediate
+template <typename Hart, typename Policy>
+inline bool execAddi(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) + d.imm;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execSlti(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = (int32_t)cpu.reg(d.rs1) < (int32_t)d.imm;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execSltiu(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) < d.imm;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execXori(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) ^ d.imm;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execOri(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) | d.imm;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execAndi(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) & d.imm;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execSlli(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) << (d.imm & 0x1F);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execSrli(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.reg(d.rs1) >> (d.imm & 0x1F);
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execSrai(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = (int32_t)cpu.reg(d.rs1) >> (d.imm & 0x1F);
+    return true;
+}
+
+// the decode cache re-checks the instruction word on every fetch, so
+// fence.i has nothing to flush
+template <typename Hart, typename Policy>
+inline bool execFence(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execFenceI(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return true;
+}
+
+// system
+template <typename Hart, typename Policy>
+inline bool execEcall(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    // the cause encodes the privilege level it was made from
+    Word_t cause = static_cast<Word_t>(ExceptionCause::ECallFromUMode) +
+                   static_cast<Word_t>(cpu.csrs().mode);
+    return cpu.trap(static_cast<ExceptionCause>(cause), 0);
+}
+template <typename Hart, typename Policy>
+inline bool execEbreak(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return cpu.trap(ExceptionCause::Breakpoint, cpu.pc());
+}
+template <typename Hart, typename Policy>
+inline bool execMret(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    if (cpu.csrs().mode != ProcessorMode::M_MODE) {
+        return cpu.trap(ExceptionCause::IllegalInst, d.bits);
+    }
+    cpu.npc() = returnFromTrap(cpu.csrs(), mem);
+    return true;
+}
+// all address spaces at once, the TLB is not split by ASID or address
+template <typename Hart, typename Policy>
+inline bool execSfenceVma(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    if (cpu.csrs().mode == ProcessorMode::U_MODE) {
+        return cpu.trap(ExceptionCause::IllegalInst, d.bits);
+    }
+    mem.flushTlb();
+    return true;
+}
+
+enum class CsrOp { Write, Set, Clear };
+
+// csrrs/csrrc with x0 (or a zero immediate) only read, so they work on
+// read-only CSRs too
+template <typename Hart>
+inline bool csrAccess(Hart& cpu, Memory& mem, const DecodedInst& d, CsrOp op,
+                      Word_t src, bool write) {
+    uint32_t csr = d.bits >> 20;
+    Word_t old;
+    if (!readCsr(cpu.csrs(), csr, old)) {
+        return cpu.trap(ExceptionCause::IllegalInst, d.bits);
+    }
+    if (write) {
+        Word_t value = op == CsrOp::Write ? src
+                       : op == CsrOp::Set ? old | src
+                                          : old & ~src;
+        if (!writeCsr(cpu.csrs(), mem, csr, value)) {
+            return cpu.trap(ExceptionCause::IllegalInst, d.bits);
+        }
+    }
+    cpu.reg(d.rd) = old;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execCsrrw(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return csrAccess(cpu, mem, d, CsrOp::Write, cpu.reg(d.rs1), true);
+}
+template <typename Hart, typename Policy>
+inline bool execCsrrs(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return csrAccess(cpu, mem, d, CsrOp::Set, cpu.reg(d.rs1), d.rs1 != 0);
+}
+template <typename Hart, typename Policy>
+inline bool execCsrrc(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return csrAccess(cpu, mem, d, CsrOp::Clear, cpu.reg(d.rs1), d.rs1 != 0);
+}
+// the immediate forms take the rs1 field as a 5-bit zero-extended value
+template <typename Hart, typename Policy>
+inline bool execCsrrwi(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return csrAccess(cpu, mem, d, CsrOp::Write, d.rs1, true);
+}
+template <typename Hart, typename Policy>
+inline bool execCsrrsi(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return csrAccess(cpu, mem, d, CsrOp::Set, d.rs1, d.rs1 != 0);
+}
+template <typename Hart, typename Policy>
+inline bool execCsrrci(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return csrAccess(cpu, mem, d, CsrOp::Clear, d.rs1, d.rs1 != 0);
+}
+
+// pseudo-instructions
+template <typename Hart, typename Policy>
+inline bool execIllegal(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return cpu.trap(ExceptionCause::IllegalInst, d.bits);
+}
+template <typename Hart, typename Policy>
+inline bool execFetchFault(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    Word_t pc = cpu.pc();
+    return cpu.trap((pc & 3) != 0 ? ExceptionCause::InstAddrMisAligned
+                                  : ExceptionCause::InstAccessFault,
+                    pc);
+}
+template <typename Hart, typename Policy>
+inline bool execFetchPageFault(Hart& cpu, Memory& mem,
+                               const DecodedInst& d) {
+    return cpu.trap(ExceptionCause::InstPageFault, cpu.pc());
+}
+
+// control transfers to a target that is not 4-byte aligned raise the
+// exception on the jump itself
+template <typename Hart>
+inline bool jumpTo(Hart& cpu, Word_t target) {
+    if ((target & 3) != 0) [[unlikely]] {
+        return cpu.trap(ExceptionCause::InstAddrMisAligned, target);
+    }
+    cpu.npc() = target;
+    return true;
+}
+
+// conditional branches. traced runs tell the hart about each, taken or
+// not, for its branch model
+template <typename Hart, typename Policy>
+inline bool branchIf(Hart& cpu, const DecodedInst& d, bool taken) {
+    if constexpr (Policy::Traced) {
+        cpu.noteBranch(taken, cpu.pc() + d.imm);
+    }
+    return taken ? jumpTo(cpu, cpu.pc() + d.imm) : true;
+}
+template <typename Hart, typename Policy>
+inline bool execBeq(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return branchIf<Hart, Policy>(cpu, d, cpu.reg(d.rs1) == cpu.reg(d.rs2));
+}
+template <typename Hart, typename Policy>
+inline bool execBne(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return branchIf<Hart, Policy>(cpu, d, cpu.reg(d.rs1) != cpu.reg(d.rs2));
+}
+template <typename Hart, typename Policy>
+inline bool execBlt(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return branchIf<Hart, Policy>(
+        cpu, d, (int32_t)cpu.reg(d.rs1) < (int32_t)cpu.reg(d.rs2));
+}
+template <typename Hart, typename Policy>
+inline bool execBge(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return branchIf<Hart, Policy>(
+        cpu, d, (int32_t)cpu.reg(d.rs1) >= (int32_t)cpu.reg(d.rs2));
+}
+template <typename Hart, typename Policy>
+inline bool execBltu(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return branchIf<Hart, Policy>(cpu, d, cpu.reg(d.rs1) < cpu.reg(d.rs2));
+}
+template <typename Hart, typename Policy>
+inline bool execBgeu(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    return branchIf<Hart, Policy>(cpu, d, cpu.reg(d.rs1) >= cpu.reg(d.rs2));
+}
+
+// upper immediates & jumps
+template <typename Hart, typename Policy>
+inline bool execLui(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = d.imm;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execAuipc(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    cpu.reg(d.rd) = cpu.pc() + d.imm;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execJal(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    Word_t link = cpu.pc() + 4;
+    if constexpr (Policy::Traced) {
+        cpu.noteJump(d, cpu.pc() + d.imm, false);
+    }
+    if (!jumpTo(cpu, cpu.pc() + d.imm)) [[unlikely]] {
+        return false;
+    }
+    cpu.reg(d.rd) = link;
+    return true;
+}
+template <typename Hart, typename Policy>
+inline bool execJalr(Hart& cpu, Memory& mem, const DecodedInst& d) {
+    Word_t link = cpu.pc() + 4;
+    Word_t target = (cpu.reg(d.rs1) + d.imm) & ~1u;
+    if constexpr (Policy::Traced) {
+        cpu.noteJump(d, target, true);
+    }
+    if (!jumpTo(cpu, target)) [[unlikely]] {
+        return false;
+    }
+    cpu.reg(d.rd) = link;
+    return true;
+}
+}  // namespace remu
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "ISA.h"
+
+namespace remu {
+// execution counts at which code moves up a tier. the tiered engine starts
+// everything in the interpreter, so short runs never pay for translation
+struct TierConfig {
+    // times a block start is reached in the interpreter before it is
+    // decoded into a cached block
+    uint32_t blockThreshold = 16;
+    // block entries before recording a trace from it, 0 never records
+    uint32_t traceThreshold = 64;
+    // block or trace entries before it is translated to native code
+    uint32_t jitThreshold = 128;
+};
+
+struct TierStats {
+    // instructions executed in each tier
+    uint64_t interpreted = 0;
+    uint64_t blockInsts = 0;
+    uint64_t nativeInsts = 0;
+    // promotions
+    uint64_t blocksTranslated = 0;
+    uint64_t tracesFormed = 0;
+    uint64_t nativeCompiled = 0;
+    uint64_t nativeFlushes = 0;
+};
+
+// decides when code moves from the interpreter to cached blocks. the later
+// steps are counted on the blocks themselves
+class TierManager {
+private:
+    static constexpr int WarmTableBits = 12;
+
+    TierConfig m_config;
+    TierStats m_stats;
+    // interpreter entry counts of block starts, hashed by pc. entries
+    // saturate at the threshold, a collision only promotes code early
+    std::vector<uint32_t> m_warmCounts;
+
+public:
+    TierManager() : m_warmCounts(1u << WarmTableBits, 0) {}
+    ~TierManager() = default;
+
+    const TierConfig& config() const { return m_config; }
+    void setConfig(const TierConfig& c) {
+        m_config = c;
+        std::fill(m_warmCounts.begin(), m_warmCounts.end(), 0);
+    }
+
+    TierStats& stats() { return m_stats; }
+
+    // count one interpreter visit of the block starting at pc, true once
+    // it should run as a cached block
+    bool warm(Word_t pc) {
+        uint32_t& count =
+            m_warmCounts[(pc >> 2) & ((1u << WarmTableBits) - 1)];
+        if (count >= m_config.blockThreshold) {
+            return true;
+        }
+        ++count;
+        return false;
+    }
+
+    bool hot(uint32_t execCount) const {
+        return execCount >= m_config.jitThreshold;
+    }
+};
+}  // namespace remu
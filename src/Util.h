@@ -13,10 +13,17 @@ inline void ThrowRuntimeError(
                              std::to_string(location.line()) + ": " + msg);
 }
 
+// kept out of line so that inlined Asserts cost only a compare and branch
+[[noreturn, gnu::cold, gnu::noinline]] inline void AssertFailed(
+    const std::source_location location) {
+    ThrowRuntimeError("Assertion Failed", location);
+    __builtin_unreachable();
+}
+
 inline void Assert(bool cond, const std::source_location location =
                                   std::source_location::current()) {
-    if (!cond) {
-        ThrowRuntimeError("Assertion Failed", location);
+    if (!cond) [[unlikely]] {
+        AssertFailed(location);
     }
 }
 
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace remu::x86 {
+enum Reg : uint8_t {
+    RAX = 0,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15
+};
+
+enum Cond : uint8_t {
+    CondB = 0x2,
+    CondAE = 0x3,
+    CondE = 0x4,
+    CondNE = 0x5,
+    CondA = 0x7,
+    CondL = 0xC,
+    CondGE = 0xD,
+};
+
+// the /digit of the 0x81 group, the 0x01/0x03 style opcodes are derived
+// from it
+enum class AluOp : uint8_t {
+    Add = 0,
+    Or = 1,
+    And = 4,
+    Sub = 5,
+    Xor = 6,
+    Cmp = 7
+};
+
+enum class ShiftOp : uint8_t { Shl = 4, Shr = 5, Sar = 7 };
+
+// minimal x86-64 encoder for the JIT, only the forms the RV32IM
+// translation needs. operations are 32-bit unless the name says otherwise.
+// writes past the end of the buffer are dropped and reported by full().
+class Emitter {
+private:
+    uint8_t* m_buf;
+    size_t m_capacity;
+    size_t m_pos;
+
+public:
+    Emitter(uint8_t* buf, size_t capacity)
+        : m_buf(buf), m_capacity(capacity), m_pos(0) {}
+
+    size_t pos() const { return m_pos; }
+    bool full() const { return m_pos > m_capacity; }
+
+    void byte(uint8_t b) {
+        if (m_pos < m_capacity) {
+            m_buf[m_pos] = b;
+        }
+        ++m_pos;
+    }
+    void dword(uint32_t d) {
+        for (int i = 0; i < 4; ++i) {
+            byte(d >> (8 * i));
+        }
+    }
+
+    // mov dst, src
+    void mov(Reg dst, Reg src) { opRR(0x89, false, src, dst); }
+    void mov64(Reg dst, Reg src) { opRR(0x89, true, src, dst); }
+    // mov dst, imm32
+    void movImm(Reg dst, uint32_t imm) {
+        rex(false, 0, 0, dst, false);
+        byte(0xB8 + (dst & 7));
+        dword(imm);
+    }
+    // mov dst, [base + disp]
+    void load(Reg dst, Reg base, int32_t disp) {
+        opRM(0x8B, false, dst, base, disp);
+    }
+    void load64(Reg dst, Reg base, int32_t disp) {
+        opRM(0x8B, true, dst, base, disp);
+    }
+    // mov [base + disp], src
+    void store(Reg base, int32_t disp, Reg src) {
+        opRM(0x89, false, src, base, disp);
+    }
+    // mov dword [base + disp], imm32
+    void storeImm(Reg base, int32_t disp, uint32_t imm) {
+        opRM(0xC7, false, 0, base, disp);
+        dword(imm);
+    }
+
+    // op dst, src
+    void alu(AluOp op, Reg dst, Reg src) {
+        opRR(0x01 + 8 * static_cast<uint8_t>(op), false, src, dst);
+    }
+    // op dst, [base + disp]
+    void alu(AluOp op, Reg dst, Reg base, int32_t disp) {
+        opRM(0x03 + 8 * static_cast<uint8_t>(op), false, dst, base, disp);
+    }
+    // op dst, imm32
+    void alu(AluOp op, Reg dst, int32_t imm) {
+        opRR(0x81, false, static_cast<uint8_t>(op), dst);
+        dword(imm);
+    }
+
+    // shift dst by cl
+    void shiftCl(ShiftOp op, Reg dst) {
+        opRR(0xD3, false, static_cast<uint8_t>(op), dst);
+    }
+    void shift(ShiftOp op, Reg dst, uint8_t imm) {
+        opRR(0xC1, false, static_cast<uint8_t>(op), dst);
+        byte(imm);
+    }
+    void shift64(ShiftOp op, Reg dst, uint8_t imm) {
+        opRR(0xC1, true, static_cast<uint8_t>(op), dst);
+        byte(imm);
+    }
+
+    // dst = (cond) ? 1 : 0, through the low byte of dst
+    void setcc(Cond c, Reg dst) {
+        rex(false, 0, 0, dst, dst >= RSP);
+        byte(0x0F);
+        byte(0x90 + c);
+        byte(modrm(3, 0, dst));
+        // movzx dst, dst8
+        rex(false, dst, 0, dst, dst >= RSP);
+        byte(0x0F);
+        byte(0xB6);
+        byte(modrm(3, dst, dst));
+    }
+
+    void test(Reg a, Reg b) { opRR(0x85, false, b, a); }
+    // imul dst, src
+    void imul(Reg dst, Reg src) { op2RR(0xAF, false, dst, src); }
+    void imul64(Reg dst, Reg src) { op2RR(0xAF, true, dst, src); }
+    // movsxd dst, src
+    void movsxd(Reg dst, Reg src) { opRR(0x63, true, dst, src); }
+    void neg(Reg dst) { opRR(0xF7, false, 3, dst); }
+    void cdq() { byte(0x99); }
+    // edx:eax / src
+    void idiv(Reg src) { opRR(0xF7, false, 7, src); }
+    void div(Reg src) { opRR(0xF7, false, 6, src); }
+
+    // loads from [base + index] with zero/sign extension to 32 bits
+    void loadU8(Reg dst, Reg base, Reg index) {
+        op2SIB(0xB6, dst, base, index);
+    }
+    void loadS8(Reg dst, Reg base, Reg index) {
+        op2SIB(0xBE, dst, base, index);
+    }
+    void loadU16(Reg dst, Reg base, Reg index) {
+        op2SIB(0xB7, dst, base, index);
+    }
+    void loadS16(Reg dst, Reg base, Reg index) {
+        op2SIB(0xBF, dst, base, index);
+    }
+    void load32(Reg dst, Reg base, Reg index) {
+        rex(false, dst, index, base, false);
+        byte(0x8B);
+        sib(dst, base, index);
+    }
+    // stores of the low bytes of src to [base + index]
+    void store8(Reg base, Reg index, Reg src) {
+        rex(false, src, index, base, src >= RSP);
+        byte(0x88);
+        sib(src, base, index);
+    }
+    void store16(Reg base, Reg index, Reg src) {
+        byte(0x66);
+        store32(base, index, src);
+    }
+    void store32(Reg base, Reg index, Reg src) {
+        rex(false, src, index, base, false);
+        byte(0x89);
+        sib(src, base, index);
+    }
+    // test byte [base + index], imm8
+    void testByte(Reg base, Reg index, uint8_t imm) {
+        rex(false, 0, index, base, false);
+        byte(0xF6);
+        sib(0, base, index);
+        byte(imm);
+    }
+
+    void push(Reg r) {
+        rex(false, 0, 0, r, false);
+        byte(0x50 + (r & 7));
+    }
+    void pop(Reg r) {
+        rex(false, 0, 0, r, false);
+        byte(0x58 + (r & 7));
+    }
+    void ret() { byte(0xC3); }
+
+    // forward jumps return the offset of their rel32 for bind()
+    size_t jcc(Cond c) {
+        byte(0x0F);
+        byte(0x80 + c);
+        dword(0);
+        return m_pos - 4;
+    }
+    size_t jmp() {
+        byte(0xE9);
+        dword(0);
+        return m_pos - 4;
+    }
+    // point the jump whose rel32 is at fixup to the current position
+    void bind(size_t fixup) { bindTo(fixup, m_pos); }
+    void bindTo(size_t fixup, size_t target) {
+        if (fixup + 4 > m_capacity) {
+            return;
+        }
+        int32_t rel = static_cast<int32_t>(target - (fixup + 4));
+        std::memcpy(m_buf + fixup, &rel, 4);
+    }
+
+private:
+    static uint8_t modrm(uint8_t mod, uint8_t reg, uint8_t rm) {
+        return (mod << 6) | ((reg & 7) << 3) | (rm & 7);
+    }
+
+    // byteReg forces a REX prefix so that 4..7 mean spl..dil, not ah..bh
+    void rex(bool w, uint8_t reg, uint8_t index, uint8_t base, bool byteReg) {
+        uint8_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) |
+                    (base >> 3);
+        if (r != 0x40 || byteReg) {
+            byte(r);
+        }
+    }
+
+    // opcode with a register-direct operand
+    void opRR(uint8_t opcode, bool w, uint8_t reg, uint8_t rm) {
+        rex(w, reg, 0, rm, false);
+        byte(opcode);
+        byte(modrm(3, reg, rm));
+    }
+    void op2RR(uint8_t opcode, bool w, uint8_t reg, uint8_t rm) {
+        rex(w, reg, 0, rm, false);
+        byte(0x0F);
+        byte(opcode);
+        byte(modrm(3, reg, rm));
+    }
+
+    // opcode with a [base + disp] operand
+    void opRM(uint8_t opcode, bool w, uint8_t reg, uint8_t base, int32_t disp) {
+        rex(w, reg, 0, base, false);
+        byte(opcode);
+        bool disp8 = disp >= -128 && disp <= 127;
+        if (disp == 0 && (base & 7) != RBP) {
+            byte(modrm(0, reg, base));
+            if ((base & 7) == RSP) {
+                byte(0x24);
+            }
+        } else {
+            byte(modrm(disp8 ? 1 : 2, reg, base));
+            if ((base & 7) == RSP) {
+                byte(0x24);
+            }
+            if (disp8) {
+                byte(static_cast<uint8_t>(disp));
+            } else {
+                dword(disp);
+            }
+        }
+    }
+
+    void op2SIB(uint8_t opcode, uint8_t reg, uint8_t base, uint8_t index) {
+        rex(false, reg, index, base, false);
+        byte(0x0F);
+        byte(opcode);
+        sib(reg, base, index);
+    }
+
+    // modrm + sib for [base + index], index must not be rsp
+    void sib(uint8_t reg, uint8_t base, uint8_t index) {
+        bool needDisp = (base & 7) == RBP;
+        byte(modrm(needDisp ? 1 : 0, reg, 4));
+        byte(((index & 7) << 3) | (base & 7));
+        if (needDisp) {
+            byte(0);
+        }
+    }
+};
+}  // namespace remu::x86
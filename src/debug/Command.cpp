@@ -148,9 +148,6 @@ bool InfoCommand::parse(const std::string& s) {
     if (list.size() != 2 || list[0] != "i") {
         return false;
     }
-    if (list[1].length() != 1) {
-        return false;
-    }
     m_target = list[1];
     return true;
 }
@@ -164,6 +161,18 @@ int InfoCommand::execute() {
     } else if (m_target == "bp") {
         m_debugger.forEachBreakpoint(
             [](const Debugger::Breakpoint& bp) { bp.print(); });
+    } else if (m_target == "tier") {
+        m_debugger.getProcessor().printTierStats();
+    } else if (m_target == "host") {
+        m_debugger.getProcessor().printHostStats();
+    } else if (m_target == "cache") {
+        m_debugger.getProcessor().printCacheStats();
+    } else if (m_target == "branch") {
+        m_debugger.getProcessor().printBranchStats();
+    } else if (m_target == "timing") {
+        m_debugger.getProcessor().printTimingStats();
+    } else if (m_target == "bus") {
+        m_debugger.getProcessor().getMemory().getBus().print();
     } else {
         std::printf("unkown target %s\n", m_target.data());
     }
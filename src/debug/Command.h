@@ -81,11 +81,11 @@ public:
 
 class InfoCommand : public ICommand {
 private:
-    // 'wp'/'reg'/'bp'
+    // 'wp'/'reg'/'bp'/'tier'/'host'/'bus'/'cache'/'branch'/'timing'
     std::string m_target;
 
 public:
-    InfoCommand(Debugger& d) : ICommand(d), m_target(0) {}
+    InfoCommand(Debugger& d) : ICommand(d) {}
     ~InfoCommand() = default;
 
     bool parse(const std::string&) override;
@@ -44,20 +44,24 @@ void Debugger::Watchpoint::print() const {
 void Debugger::addWatchPoint(Word_t addr) {
     Watchpoint wp({addr, addr + 3}, m_mem);
     int wpId = wp.getId();
-    m_mem.addMemWriteTracer(MemTracer(
-        wp.getId(), wp.getMemSpan(),
-        [wpId, this](Word_t vaddr, Word_t data, int numOfBytes) {
-            std::printf(
-                "[Watchpoint %d]: write %d bytes at 0x%08x, data = 0x%08x\n",
-                wpId, numOfBytes, vaddr, data);
-            m_pause = true;
-        }));
+    if (!m_mem.addWriteWatch(wpId, wp.getMemSpan())) {
+        // no page protection here, trace every store instead
+        m_mem.addMemWriteTracer(MemTracer(
+            wp.getId(), wp.getMemSpan(),
+            [wpId, this](Word_t vaddr, Word_t data, int numOfBytes) {
+                std::printf("[Watchpoint %d]: write %d bytes at 0x%08x, "
+                            "data = 0x%08x\n",
+                            wpId, numOfBytes, vaddr, data);
+                m_pause = true;
+            }));
+    }
     m_watchpoints.insert(wp);
 }
 
 void Debugger::removeWatchPoint(int id) {
     for (auto& wp : m_watchpoints) {
         if (wp.getId() == id) {
+            m_mem.removeWriteWatch(id);
             m_mem.removeMemWriteTracer(id);
             m_watchpoints.erase(wp);
             break;
@@ -73,6 +77,11 @@ void Debugger::start() {
         if (itor != m_breakpoints.end()) {
             pause = true;
         }
+        // a hart stopped by a trap it could not take does not go on
+        if (m_cpu.getState() != REMUState::RUNNING || m_pause) {
+            pause = true;
+            m_pause = false;
+        }
 
         int num = 0;
         if (pause) {
@@ -85,10 +94,19 @@ void Debugger::start() {
 
         if (num > 0) {
             m_cpu.execute(1);
+            reportWatchHits();
         }
     }
 }
 
+void Debugger::reportWatchHits() {
+    for (const WatchHit& hit : m_mem.takeWatchHits()) {
+        std::printf("[Watchpoint %d]: write at 0x%08x, data = 0x%08x\n",
+                    hit.id, hit.vaddr, hit.data);
+        m_pause = true;
+    }
+}
+
 std::unique_ptr<ICommand> Debugger::handleInput() {
     std::unique_ptr<ICommand> cmd;
     while (!cmd) {
@@ -143,5 +143,6 @@ public:
 
 private:
     std::unique_ptr<ICommand> handleInput();
+    void reportWatchHits();
 };
 }  // namespace remu
\ No newline at end of file
@@ -1,37 +1,10 @@
-#include <iostream>
+#include <getopt.h>
 
-#include "Memory.h"
-#include "Processor.h"
-#include "debug/Debugger.h"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 
-namespace remu {
-class Machine {
-private:
-    Memory m_mem;
-    Processor m_cpu;
-    Debugger m_debugger;
-
-public:
-    Machine() : m_mem(), m_cpu(m_mem), m_debugger(m_cpu, m_mem) {}
-    ~Machine() {}
-
-    Memory& getMemory() { return m_mem; }
-    Processor& getProcessor() { return m_cpu; }
-    Debugger& getDebugger() { return m_debugger; }
-
-    void start() {
-        try {
-            m_cpu.execute(UINT64_MAX);
-        } catch (std::exception& e) {
-            std::cout << e.what() << std::endl;
-        }
-    }
-
-    void debug() { m_debugger.start(); }
-
-    void stop() {}
-};
-}  // namespace remu
+#include "Machine.h"
 
 static const Word_t img[] = {
     0x00000297,  // auipc t0,0
@@ -42,18 +15,278 @@ static const Word_t img[] = {
 };
 
 static void copySampleCode(remu::Machine& m) {
-    Word_t addr = remu::MemBase;
+    Word_t addr = m.getMemory().getBase();
     for (Word_t inst : img) {
         m.getMemory().vMemWrite<Word_t>(addr, inst);
         addr += 4;
     }
 }
 
-int main() {
-    remu::Machine machine;
+static void usage(const char* prog) {
+    std::printf(
+        "usage: %s [-e|--engine interpreter|threaded|tailcall|block|jit|\n"
+        "                    tiered]\n"
+        "          [-t|--thresholds block,trace,jit]\n"
+        "          [-m|--memory size[,base]] [-H|--huge-pages]\n"
+        "          [-s|--host-stats]\n"
+        "          [-I|--icache size,ways,line[,lru|plru|random]]\n"
+        "          [-D|--dcache size,ways,line[,lru|plru|random][,wb|wt]]\n"
+        "          [-2|--l2 size,ways,line[,lru|plru|random]]\n"
+        "          [-3|--l3 size,ways,line[,lru|plru|random]]\n"
+        "          [-P|--cache-policy inclusive|exclusive|nine[,msi|mesi]]\n"
+        "          [-S|--sweep file] [-j|--sweep-threads n]\n"
+        "          [-B|--branch bimodal|gshare|tage[,table bits][,btb bits]\n"
+        "                       [,ras depth]]\n"
+        "          [-T|--timing[=mul,div,load-use,branch,jump,flush,l2,l3,\n"
+        "                        mem]]\n",
+        prog);
+}
+
+// "block,trace,jit", empty fields keep their value
+static bool parseThresholds(const char* arg, remu::TierConfig& c) {
+    uint32_t* fields[] = {&c.blockThreshold, &c.traceThreshold,
+                          &c.jitThreshold};
+    const char* p = arg;
+    for (uint32_t* field : fields) {
+        char* end;
+        unsigned long v = std::strtoul(p, &end, 0);
+        if (end != p) {
+            *field = v;
+        }
+        if (*end == '\0') {
+            return true;
+        }
+        if (*end != ',') {
+            return false;
+        }
+        p = end + 1;
+    }
+    return false;
+}
+
+// a hierarchy per line, see parseHierarchyConfig. blank lines and lines
+// starting with # are skipped
+static bool readSweep(const char* path,
+                      std::vector<remu::HierarchyConfig>& configs) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find_first_not_of(" \t") == std::string::npos ||
+            line[line.find_first_not_of(" \t")] == '#') {
+            continue;
+        }
+        remu::HierarchyConfig c;
+        if (!remu::parseHierarchyConfig(line, c)) {
+            std::printf("bad cache hierarchy: %s\n", line.data());
+            return false;
+        }
+        configs.push_back(c);
+    }
+    return !configs.empty();
+}
+
+// "size[,base]", size may end in K, M or G
+static bool parseMemory(const char* arg, Word_t& base, Word_t& size) {
+    char* end;
+    unsigned long long v = std::strtoull(arg, &end, 0);
+    const char* suffixes = "KMG";
+    const char* suffix = *end != '\0' ? std::strchr(suffixes, *end) : nullptr;
+    if (suffix != nullptr) {
+        int shift = 10 * (suffix - suffixes + 1);
+        // too large to shift is too large for RAM
+        if (v > (1ull << 32) >> shift) {
+            return false;
+        }
+        v <<= shift;
+        ++end;
+    }
+    if (end == arg || v == 0 || v > (1ull << 32) - remu::PageSize) {
+        return false;
+    }
+    size = v;
+    if (*end == ',') {
+        const char* p = end + 1;
+        v = std::strtoull(p, &end, 0);
+        if (end == p || v > UINT32_MAX) {
+            return false;
+        }
+        base = v;
+    }
+    // Memory wants a page aligned RAM inside the 32-bit space
+    return *end == '\0' && ((base | size) & (remu::PageSize - 1)) == 0 &&
+           uint64_t{base} + size <= (1ull << 32);
+}
+
+int main(int argc, char* argv[]) {
+    remu::ExecEngine engine = remu::ExecEngine::Tiered;
+    remu::TierConfig config;
+    Word_t memBase = remu::DefaultMemBase;
+    Word_t memSize = remu::DefaultMemSize;
+    bool hugePages = false;
+    bool hostStats = false;
+    bool caches = false;
+    remu::HierarchyConfig hierarchy;
+    std::vector<remu::HierarchyConfig> sweep;
+    unsigned sweepThreads = 0;
+    bool branches = false;
+    remu::BranchConfig branchConfig;
+    bool timing = false;
+    remu::PipelineConfig pipeline;
+
+    const option longOptions[] = {{"engine", required_argument, nullptr, 'e'},
+                                  {"thresholds", required_argument, nullptr,
+                                   't'},
+                                  {"memory", required_argument, nullptr, 'm'},
+                                  {"huge-pages", no_argument, nullptr, 'H'},
+                                  {"host-stats", no_argument, nullptr, 's'},
+                                  {"icache", required_argument, nullptr, 'I'},
+                                  {"dcache", required_argument, nullptr, 'D'},
+                                  {"l2", required_argument, nullptr, '2'},
+                                  {"l3", required_argument, nullptr, '3'},
+                                  {"cache-policy", required_argument, nullptr,
+                                   'P'},
+                                  {"sweep", required_argument, nullptr, 'S'},
+                                  {"sweep-threads", required_argument, nullptr,
+                                   'j'},
+                                  {"branch", required_argument, nullptr, 'B'},
+                                  {"timing", optional_argument, nullptr, 'T'},
+                                  {"help", no_argument, nullptr, 'h'},
+                                  {nullptr, 0, nullptr, 0}};
+    int opt;
+    const char* shortOptions = "e:t:m:HsI:D:2:3:P:S:j:B:T::h";
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions,
+                              nullptr)) != -1) {
+        switch (opt) {
+            case 'e':
+                if (std::strcmp(optarg, "interpreter") == 0) {
+                    engine = remu::ExecEngine::Interpreter;
+                } else if (std::strcmp(optarg, "threaded") == 0) {
+                    engine = remu::ExecEngine::Threaded;
+                } else if (std::strcmp(optarg, "tailcall") == 0) {
+                    engine = remu::ExecEngine::TailCall;
+                } else if (std::strcmp(optarg, "block") == 0) {
+                    engine = remu::ExecEngine::Block;
+                } else if (std::strcmp(optarg, "jit") == 0) {
+                    engine = remu::ExecEngine::Jit;
+                } else if (std::strcmp(optarg, "tiered") == 0) {
+                    engine = remu::ExecEngine::Tiered;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 't':
+                if (!parseThresholds(optarg, config)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'm':
+                if (!parseMemory(optarg, memBase, memSize)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'H':
+                hugePages = true;
+                break;
+            case 's':
+                hostStats = true;
+                break;
+            case 'I':
+            case 'D':
+            case '2':
+            case '3': {
+                remu::CacheConfig& c = opt == 'I'   ? hierarchy.l1i
+                                       : opt == 'D' ? hierarchy.l1d
+                                       : opt == '2' ? hierarchy.l2
+                                                    : hierarchy.l3;
+                if (!remu::parseCacheConfig(optarg, c)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                hierarchy.hasL3 |= opt == '3';
+                caches = true;
+                break;
+            }
+            case 'P':
+                if (!remu::parseHierarchyPolicy(optarg, hierarchy)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                caches = true;
+                break;
+            case 'S':
+                if (!readSweep(optarg, sweep)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'j': {
+                char* end;
+                unsigned long v = std::strtoul(optarg, &end, 0);
+                if (end == optarg || *end != '\0' || v > UINT32_MAX) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                sweepThreads = v;
+                break;
+            }
+            case 'B':
+                if (!remu::parseBranchConfig(optarg, branchConfig)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                branches = true;
+                break;
+            case 'T':
+                if (optarg != nullptr &&
+                    !remu::parsePipelineConfig(optarg, pipeline)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                timing = true;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    // RAM is placed when the machine is built
+    remu::Machine machine(memBase, memSize);
+    machine.getProcessor().setEngine(engine);
+    machine.getProcessor().setTierConfig(config);
+    if (hugePages && !machine.getMemory().setHugePages(true)) {
+        std::printf("huge pages not available\n");
+    }
+    if (hostStats && !machine.getProcessor().openHostCounters()) {
+        std::printf("host counters not available\n");
+    }
+
+    // a sweep takes the place of the single hierarchy. levels not given
+    // keep their defaults
+    if (!sweep.empty()) {
+        machine.getProcessor().enableCacheSweep(std::move(sweep),
+                                                sweepThreads);
+    } else if (caches && !machine.getProcessor().enableCaches(hierarchy)) {
+        std::printf("invalid cache hierarchy\n");
+        return 1;
+    }
+    if (branches) {
+        machine.getProcessor().enableBranchModel(branchConfig);
+    }
+    if (timing) {
+        machine.getProcessor().enableTiming(pipeline);
+    }
+
     copySampleCode(machine);
 
-    machine.getDebugger().addBreakPoint(remu::MemBase);
+    machine.getDebugger().addBreakPoint(memBase);
 
     machine.debug();
 